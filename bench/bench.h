@@ -0,0 +1,71 @@
+#pragma once
+
+#include "color_space.h"
+#include "kmeans.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+/**
+ * Helpers shared by the benchmarks: a synthetic image drawn from a fixed seed, its Lab samples and a wall clock.
+ */
+
+// Pixels scattered around `blobs` random colors of random size and spread, without library distributions, so every
+// platform draws the same image.
+inline std::vector<unsigned char> bench_pixels(std::size_t n, int blobs = 32, unsigned seed = 42) {
+  std::mt19937 gen(seed);
+  std::vector<int> centers(blobs * 3), spreads(blobs);
+  std::vector<std::size_t> sizes(blobs);
+  std::size_t total = 0;
+  for (int i = 0; i < blobs; i++) {
+    for (int c = 0; c < 3; c++) {
+      centers[i * 3 + c] = gen() % 256;
+    }
+    spreads[i] = 4 + gen() % 40;
+    sizes[i] = 1 + gen() % 100;
+    total += sizes[i];
+  }
+
+  std::vector<unsigned char> pixels;
+  pixels.reserve(n * 3);
+  for (std::size_t j = 0; j < n; j++) {
+    // blob of pixel j in proportion to the blob sizes, walking the cumulative sizes
+    std::size_t pick = j * total / n;
+    int i = 0;
+    while (pick >= sizes[i]) {
+      pick -= sizes[i++];
+    }
+    for (int c = 0; c < 3; c++) {
+      int value = centers[i * 3 + c] + (int)(gen() % (2 * spreads[i] + 1)) - spreads[i];
+      pixels.push_back((unsigned char)std::min(std::max(value, 0), 255));
+    }
+  }
+  return pixels;
+}
+
+template <typename Scalar> BasicKMeans<3, Scalar> bench_samples(const std::vector<unsigned char> &pixels) {
+  std::size_t n = pixels.size() / 3;
+  std::vector<Scalar> l(n), a(n), b(n);
+  rgb_to_lab(pixels.data(), n, l.data(), a.data(), b.data());
+  BasicKMeans<3, Scalar> km;
+  km.reserve(n);
+  for (std::size_t j = 0; j < n; j++) {
+    km.push_back({l[j], a[j], b[j]});
+  }
+  return km;
+}
+
+// Fastest of `runs` calls of fn(), in seconds.
+template <typename F> double best_seconds(int runs, F fn) {
+  double best = 0;
+  for (int r = 0; r < runs; r++) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    best = r == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
@@ -0,0 +1,106 @@
+#include "bench.h"
+#include "kmeans_kernel.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+/**
+ * One nearest-centroid pass over the same Lab points in each sample layout BasicKMeans could keep: a std::vector per
+ * point with a runtime dimension as it used to, contiguous fixed-size points, and per-channel arrays with the scalar
+ * and the vectorized kernel. Prints nanoseconds per point.
+ */
+
+const int K = 16;
+const int DIM = 3;
+
+// the loop of the old runtime-dimension KMeans
+std::size_t assign_vectors(const std::vector<std::vector<double>> &points,
+                           const std::vector<std::vector<double>> &centroids, uint32_t *labels) {
+  std::size_t moved = 0;
+  for (std::size_t j = 0; j < points.size(); j++) {
+    double min_dist = std::numeric_limits<double>::infinity();
+    uint32_t min_i = 0;
+    for (std::size_t i = 0; i < centroids.size(); i++) {
+      double dist = 0;
+      for (std::size_t d = 0; d < points[j].size(); d++) {
+        double diff = points[j][d] - centroids[i][d];
+        dist += diff * diff;
+      }
+      if (dist < min_dist) {
+        min_dist = dist;
+        min_i = i;
+      }
+    }
+    moved += labels[j] != min_i;
+    labels[j] = min_i;
+  }
+  return moved;
+}
+
+std::size_t assign_arrays(const std::vector<std::array<double, DIM>> &points, const double *centroids,
+                          uint32_t *labels) {
+  std::size_t moved = 0;
+  for (std::size_t j = 0; j < points.size(); j++) {
+    double min_dist = std::numeric_limits<double>::infinity();
+    uint32_t min_i = 0;
+    for (int i = 0; i < K; i++) {
+      double dist = 0;
+      for (int d = 0; d < DIM; d++) {
+        double diff = points[j][d] - centroids[i * DIM + d];
+        dist += diff * diff;
+      }
+      if (dist < min_dist) {
+        min_dist = dist;
+        min_i = i;
+      }
+    }
+    moved += labels[j] != min_i;
+    labels[j] = min_i;
+  }
+  return moved;
+}
+
+int main() {
+  std::printf("%-9s %12s %12s %12s %12s\n", "n", "vector ns", "array ns", "soa ns", "soa simd ns");
+  for (std::size_t n : {1000, 100000, 10000000}) {
+    int runs = n < 1000000 ? 20 : 3;
+    std::vector<unsigned char> pixels = bench_pixels(n);
+    std::vector<double> l(n), a(n), b(n);
+    rgb_to_lab(pixels.data(), n, l.data(), a.data(), b.data());
+    pixels = std::vector<unsigned char>();
+    const double *channels[DIM] = {l.data(), a.data(), b.data()};
+
+    std::vector<std::vector<double>> vectors(n);
+    std::vector<std::array<double, DIM>> arrays(n);
+    for (std::size_t j = 0; j < n; j++) {
+      vectors[j] = {l[j], a[j], b[j]};
+      arrays[j] = {l[j], a[j], b[j]};
+    }
+    // centroids at evenly spread points
+    std::vector<double> centroids(K * DIM);
+    std::vector<std::vector<double>> centroid_vectors(K);
+    for (int i = 0; i < K; i++) {
+      std::size_t j = n / K * i;
+      centroid_vectors[i] = vectors[j];
+      for (int d = 0; d < DIM; d++) {
+        centroids[i * DIM + d] = channels[d][j];
+      }
+    }
+
+    std::vector<uint32_t> labels(n);
+    double seconds[4];
+    seconds[0] = best_seconds(runs, [&]() { assign_vectors(vectors, centroid_vectors, labels.data()); });
+    seconds[1] = best_seconds(runs, [&]() { assign_arrays(arrays, centroids.data(), labels.data()); });
+    seconds[2] = best_seconds(
+        runs, [&]() { assign_nearest_scalar<DIM, double>(channels, 0, n, centroids.data(), K, labels.data()); });
+    seconds[3] =
+        best_seconds(runs, [&]() { assign_nearest<DIM, double>(channels, 0, n, centroids.data(), K, labels.data()); });
+    std::printf("%-9zu %12.2f %12.2f %12.2f %12.2f\n", n, seconds[0] * 1e9 / n, seconds[1] * 1e9 / n,
+                seconds[2] * 1e9 / n, seconds[3] * 1e9 / n);
+  }
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include "bench.h"
+#include "color_space.h"
+#include "kmeans.h"
+#include "myrand.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Mini-batch k-means against Lloyd on the same samples and seeds: time to the final palette, and its quality as the
+ * mean CIEDE2000 from every pixel to its centroid and as inertia.
+ */
+
+const int RUNS = 3;
+
+double mean_color_diff(const BasicKMeans<3, double> &km, const std::vector<BasicKMeans<3, double>::Cluster> &clusters) {
+  const std::vector<uint32_t> &labels = km.get_labels();
+  double total = 0;
+  for (std::size_t j = 0; j < km.size(); j++) {
+    const auto &centroid = clusters[labels[j]].centroid;
+    LAB point = {km.channel(0)[j], km.channel(1)[j], km.channel(2)[j]};
+    total += color_diff(point, {centroid[0], centroid[1], centroid[2]});
+  }
+  return total / km.size();
+}
+
+int main() {
+  std::printf("%-9s %-3s %-10s %9s %6s %8s %14s\n", "n", "k", "engine", "seconds", "iter", "CIEDE", "inertia");
+  for (std::size_t n : {100000, 1000000}) {
+    BasicKMeans<3, double> km = bench_samples<double>(bench_pixels(n));
+    for (int k : {8, 16, 32}) {
+      for (Engine engine : {Engine::lloyd, Engine::minibatch}) {
+        KMeansOptions options;
+        options.engine = engine;
+        km.set_options(options);
+        std::vector<BasicKMeans<3, double>::Cluster> clusters;
+        double seconds = best_seconds(RUNS, [&]() {
+          MyRand rng(1);
+          clusters = km.cluster(k, rng);
+        });
+        const KMeansStats &stats = km.get_stats();
+        std::printf("%-9zu %-3d %-10s %9.3f %6d %8.3f %14.6g\n", n, k, engine == Engine::lloyd ? "lloyd" : "minibatch",
+                    seconds, stats.iterations, mean_color_diff(km, clusters), stats.inertia);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+#include "bench.h"
+#include "kmeans.h"
+#include "kmeans_seeding.h"
+#include "myrand.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Seeding strategies by what they save the Lloyd passes that follow: the time to seed, then the iterations, time and
+ * inertia of Lloyd warm-started from the seeds, averaged over several seeds. Random pixels are the baseline every other
+ * strategy is measured against.
+ */
+
+const std::size_t N = 200000;
+const int SEEDS = 5;
+
+using Seeds = std::vector<std::array<double, 3>>;
+
+int main() {
+  BasicKMeans<3, double> km = bench_samples<double>(bench_pixels(N));
+  const double *channels[3] = {km.channel(0), km.channel(1), km.channel(2)};
+  const uint32_t *weights = km.get_weights();
+  const char *names[] = {"random", "farthest", "kmeans++", "kmeans||"};
+
+  std::printf("%-3s %-9s %10s %8s %8s %10s %14s\n", "k", "seeding", "seed ms", "iter", "saved", "lloyd ms",
+              "inertia");
+  for (int k : {8, 16, 32}) {
+    double random_iterations = 0;
+    for (int method = 0; method < 4; method++) {
+      double seed_seconds = 0, lloyd_seconds = 0, iterations = 0, inertia = 0;
+      for (int s = 0; s < SEEDS; s++) {
+        MyRand rng(s + 1);
+        Seeds seeds;
+        seed_seconds += best_seconds(1, [&]() {
+          if (method == 0) {
+            seeds.clear();
+            for (int i = 0; i < k; i++) {
+              std::size_t j = rng.randint(0, N - 1);
+              seeds.push_back({channels[0][j], channels[1][j], channels[2][j]});
+            }
+          } else if (method == 1) {
+            seeds = seed_farthest<3, double>(channels, weights, N, k, rng, 1);
+          } else if (method == 2) {
+            seeds = seed_kmeanspp<3, double>(channels, weights, N, k, rng, 1);
+          } else {
+            seeds = seed_parallel<3, double>(channels, weights, N, k, rng, 1);
+          }
+        });
+        lloyd_seconds += best_seconds(1, [&]() { km.cluster(k, seeds, rng); });
+        iterations += km.get_stats().iterations;
+        inertia += km.get_stats().inertia;
+      }
+      iterations /= SEEDS;
+      if (method == 0) {
+        random_iterations = iterations;
+      }
+      std::printf("%-3d %-9s %10.2f %8.1f %8.1f %10.1f %14.6g\n", k, names[method], seed_seconds / SEEDS * 1000,
+                  iterations, random_iterations - iterations, lloyd_seconds / SEEDS * 1000, inertia / SEEDS);
+    }
+  }
+  return 0;
+}
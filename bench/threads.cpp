@@ -0,0 +1,64 @@
+#include "bench.h"
+#include "kmeans.h"
+#include "kmeans_kernel.h"
+#include "myrand.h"
+#include "parallel.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+/**
+ * What parallel_for() costs against the work it hands out. For each thread count: a call with empty tasks, which is
+ * the bare cost of starting and joining the threads; one CHUNK-sized assignment task for scale; and a Lloyd run over
+ * the full sample, whose time per iteration shows the scaling.
+ */
+
+const std::size_t N = 1000000;
+const int K = 16;
+const int CALLS = 1000;
+
+int main() {
+  BasicKMeans<3, double> km = bench_samples<double>(bench_pixels(N));
+  const double *channels[3] = {km.channel(0), km.channel(1), km.channel(2)};
+
+  std::vector<double> centroids(K * 3);
+  for (int i = 0; i < K; i++) {
+    for (int d = 0; d < 3; d++) {
+      centroids[i * 3 + d] = channels[d][N / K * i];
+    }
+  }
+  std::vector<uint32_t> labels(N);
+  double chunk_seconds =
+      best_seconds(20, [&]() { assign_nearest<3, double>(channels, 0, CHUNK, centroids.data(), K, labels.data()); });
+
+  std::printf("%u hardware threads, one CHUNK of %zu points assigned to k = %d in %.1f us\n",
+              std::thread::hardware_concurrency(), CHUNK, K, chunk_seconds * 1e6);
+  std::printf("%-8s %12s %10s %6s %12s %10s\n", "threads", "spawn us", "lloyd ms", "iter", "ms / iter", "speedup");
+  double single = 0;
+  for (int threads : {1, 2, 4, 8}) {
+    double spawn_seconds = best_seconds(3, [&]() {
+      for (int call = 0; call < CALLS; call++) {
+        parallel_for(threads, threads, [](std::size_t) {});
+      }
+    });
+
+    KMeansOptions options;
+    options.threads = threads;
+    km.set_options(options);
+    double lloyd_seconds = best_seconds(3, [&]() {
+      MyRand rng(1);
+      km.cluster(K, rng);
+    });
+    int iterations = km.get_stats().iterations;
+    double per_iteration = lloyd_seconds / iterations;
+    if (threads == 1) {
+      single = per_iteration;
+    }
+    std::printf("%-8d %12.1f %10.1f %6d %12.2f %10.2f\n", threads, spawn_seconds / CALLS * 1e6, lloyd_seconds * 1000,
+                iterations, per_iteration * 1000, single / per_iteration);
+  }
+  return 0;
+}
@@ -1,11 +1,70 @@
 #pragma once
 
 #include "color_space.h"
+#include "curve.h"
+#include "kmeans.h"
+#include "kmeans_select.h"
 #include "myrand.h"
 
+#include <cstddef>
 #include <string>
 #include <utility>
 #include <vector>
 
+enum class Quantizer {
+  kmeans, // k-means over sampled or histogram binned Lab points
+  octree, // every pixel streamed into a bounded octree, then reduced to the requested number of colors
+  wu,     // Wu's variance minimizing box cuts over a histogram of every pixel
+};
+
+enum class Space {
+  lab,   // CIELAB under D65
+  oklab, // Oklab, scaled by 100 so that distances, --tol and the repair thresholds keep about the size of Lab units
+  rgb,   // sRGB channel values in [0, 255], no conversion at all
+};
+
+struct SchemeOptions {
+  Quantizer quantizer = Quantizer::kmeans;
+  int clusters = 8;
+  int samples = 1000;
+  int histogram_bits = 0; // when set, cluster every pixel through an RGB histogram instead of sampling
+  Space space = Space::lab; // where k-means measures distances between colors
+  std::string lab_table;     // when set, convert pixels through the RGB to Lab grid in this file, built on first use
+  int lab_table_cells = 64;
+  Curve order = Curve::none; // space-filling curve the k-means points are sorted along before clustering
+  bool wu_seeding = false; // seed k-means with Wu's quantizer over every pixel, unless initial centroids are given
+  Criterion criterion = Criterion::elbow; // how auto_color_scheme() picks the number of clusters
+  KMeansOptions kmeans;
+};
+
+// What auto_color_scheme() weighed: the score of every candidate count, the gap statistic's standard errors, and the
+// stats of each candidate's k-means run.
+struct ClusterChoice {
+  std::vector<int> counts;
+  std::vector<double> scores;
+  std::vector<double> errors;
+  std::vector<KMeansStats> stats;
+  std::size_t chosen = 0;
+};
+
 std::vector<std::pair<RGB, double>> color_scheme(const std::string &, int, int);
-std::vector<std::pair<RGB, double>> color_scheme(const std::string &, int, int, MyRand &);
\ No newline at end of file
+std::vector<std::pair<RGB, double>> color_scheme(const std::string &, int, int, MyRand &);
+std::vector<std::pair<RGB, double>> color_scheme(const std::string &, const SchemeOptions &, MyRand &,
+                                                 KMeansStats *stats = nullptr);
+// Warm start k-means from an earlier palette, e.g. one read back with read_palette().
+std::vector<std::pair<RGB, double>> color_scheme(const std::string &, const SchemeOptions &, const std::vector<RGB> &,
+                                                 MyRand &, KMeansStats *stats = nullptr);
+
+// Schemes for several numbers of clusters from a single decode and sample, `options.clusters` is not used. Stats, when
+// asked for, are those of the k-means run behind each scheme; the bisecting engine serves every count from one run.
+std::vector<std::vector<std::pair<RGB, double>>> color_schemes(const std::string &, const SchemeOptions &,
+                                                               const std::vector<int> &, const std::vector<RGB> &,
+                                                               MyRand &, std::vector<KMeansStats> *stats = nullptr);
+
+// Scheme for the number of clusters in [min, max] picked by `options.criterion`, `options.clusters` is not used. Every
+// candidate clusters the same Lab points; k-means only, without Wu seeding.
+std::vector<std::pair<RGB, double>> auto_color_scheme(const std::string &, const SchemeOptions &, int min, int max,
+                                                      MyRand &, ClusterChoice *choice = nullptr);
+
+// Read the colors of a palette in the `#rrggbb` output format, one per line, anything after the color is ignored.
+std::vector<RGB> read_palette(const std::string &);
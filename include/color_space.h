@@ -1,24 +1,92 @@
 #pragma once
 
-struct RGB {
-  double r;
-  double g;
-  double b;
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Color types are templated on the channel type, so the clustering pipeline can run in single precision.
+template <typename T> struct BasicRGB {
+  T r;
+  T g;
+  T b;
+};
+
+template <typename T> struct BasicLAB {
+  T l;
+  T a;
+  T b;
 };
 
-struct LAB {
-  double l;
-  double a;
-  double b;
+// Oklab (Ottosson 2020): L in [0, 1], a and b roughly within [-0.4, 0.4].
+template <typename T> struct BasicOKLAB {
+  T l;
+  T a;
+  T b;
 };
 
-struct XYZ {
-  double x;
-  double y;
-  double z;
+template <typename T> struct BasicXYZ {
+  T x;
+  T y;
+  T z;
 };
 
+using RGB = BasicRGB<double>;
+using LAB = BasicLAB<double>;
+using OKLAB = BasicOKLAB<double>;
+using XYZ = BasicXYZ<double>;
+
+template <typename T> BasicLAB<T> rgb_to_lab(const BasicRGB<T> &);
+template <typename T> BasicRGB<T> lab_to_rgb(const BasicLAB<T> &);
+template <typename T> BasicOKLAB<T> rgb_to_oklab(const BasicRGB<T> &);
+template <typename T> BasicRGB<T> oklab_to_rgb(const BasicOKLAB<T> &);
+// Double-precision overloads, so braced calls like rgb_to_lab({r, g, b}) need no template argument.
 LAB rgb_to_lab(const RGB &);
 RGB lab_to_rgb(const LAB &);
 
+// Convert n 8-bit pixels to Lab channel arrays. The channels of pixel j are read from red[j * stride],
+// green[j * stride] and blue[j * stride], so planar buffers take stride 1. Vectorized with the widest of AVX-512, AVX2
+// and SSE4.1 the CPU supports, picked at run time; elsewhere, or with COLOR_SCHEME_EXACT_LAB, one pixel at a time.
+template <typename T>
+void rgb_to_lab(const unsigned char *red, const unsigned char *green, const unsigned char *blue, std::size_t stride,
+                std::size_t n, T *l, T *a, T *b);
+// Interleaved RGB pixels, as returned by stbi_load().
+template <typename T> void rgb_to_lab(const unsigned char *rgb, std::size_t n, T *l, T *a, T *b);
+
 double color_diff(const LAB &, const LAB &);
+
+/**
+ * RGB to Lab lookup grid of (cells + 1)^3 nodes spread evenly over [0, 255]^3, converting by trilinear interpolation
+ * between the eight nodes around a color.
+ *
+ * The grid lives in a file that is mapped read-only, so every process converting through the same file shares one copy
+ * of its pages. A missing file, or one written by another version, for another number of cells or failing its checksum,
+ * is rebuilt from rgb_to_lab() and atomically replaced. Where files cannot be mapped the grid is read into memory.
+ */
+class LabTable {
+private:
+  int cells;
+  const float *grid; // three channels per node, blue varying fastest
+  void *mapping;
+  std::size_t mapping_size;
+  std::vector<float> owned; // grid storage when the file is read rather than mapped
+  // cell and position within it of each 8-bit channel value
+  std::array<uint32_t, 256> cell;
+  std::array<float, 256> weight;
+
+  bool open(const std::string &);
+  void build(const std::string &) const;
+  BasicLAB<float> interpolate(uint32_t, uint32_t, uint32_t, float, float, float) const;
+
+public:
+  LabTable(const std::string &path, int cells = 64);
+  ~LabTable();
+  LabTable(const LabTable &) = delete;
+  LabTable &operator=(const LabTable &) = delete;
+
+  int get_cells() const;
+  template <typename T> BasicLAB<T> convert(const BasicRGB<T> &) const;
+  // Interleaved 8-bit pixels, as for the batch rgb_to_lab().
+  template <typename T> void convert(const unsigned char *rgb, std::size_t n, T *l, T *a, T *b) const;
+};
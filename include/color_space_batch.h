@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Vectorized kernels behind the batch rgb_to_lab(), one per instruction set. Each lives in its own translation unit
+ * that targets that instruction set through a pragma, and rgb_to_lab() calls the widest one the CPU supports.
+ * Arguments are those of the batch rgb_to_lab() plus `linear`, the sRGB decoding of every 8-bit channel value.
+ *
+ * The kernel body below is shared: each translation unit supplies a vector policy V over doubles and instantiates it.
+ * Everything runs in double and is rounded once on the store, so the float kernels are as accurate as the double ones.
+ * The body stays clear of library templates, whose instantiations the linker could otherwise pick from a translation
+ * unit built for a wider instruction set than the CPU has.
+ */
+
+#define DECLARE_LAB_KERNELS(isa)                                                                                      \
+  void rgb8_to_lab_##isa(const unsigned char *, const unsigned char *, const unsigned char *, std::size_t,            \
+                         std::size_t, const double *, double *, double *, double *);                                   \
+  void rgb8_to_lab_##isa(const unsigned char *, const unsigned char *, const unsigned char *, std::size_t,            \
+                         std::size_t, const double *, float *, float *, float *);
+
+DECLARE_LAB_KERNELS(sse41)
+DECLARE_LAB_KERNELS(avx2)
+DECLARE_LAB_KERNELS(avx512)
+
+// pixels per block; channel values are spread into index arrays first, which the vector loop gathers through
+const std::size_t LAB_BLOCK = 256;
+
+// Initial cube root estimate on [1, 8): the cubic through the Chebyshev nodes, within 1.4% of the root, which two
+// Halley steps bring below 1e-15.
+const double CBRT_POLY[4] = {0.71673464186044167, 0.32883645446314763, -0.034026053652904842, 0.0016274953380330877};
+
+// Cube root of x > 0: split x into m * 2^e with m in [1, 2), take the root of m * 2^(e mod 3) from the polynomial,
+// scale it by 2^floor(e / 3), then refine against x.
+template <typename V> typename V::Reg cube_root_vec(typename V::Reg x) {
+  using Reg = typename V::Reg;
+  Reg e = V::sub(V::exponent(x), V::set1(1023));
+  Reg q = V::floor(V::div(e, V::set1(3)));
+  Reg s = V::mul(V::mantissa(x), V::pow2(V::sub(e, V::mul(q, V::set1(3)))));
+
+  Reg y = V::set1(CBRT_POLY[3]);
+  for (int i = 2; i >= 0; i--) {
+    y = V::add(V::mul(y, s), V::set1(CBRT_POLY[i]));
+  }
+  y = V::mul(y, V::pow2(q));
+
+  for (int i = 0; i < 2; i++) {
+    Reg y3 = V::mul(V::mul(y, y), y);
+    Reg two_x = V::add(x, x);
+    y = V::div(V::mul(y, V::add(y3, two_x)), V::add(V::add(y3, y3), x));
+  }
+  return y;
+}
+
+// Lab transfer function: cube root above 0.008856, the linear segment below.
+template <typename V> typename V::Reg lab_f_vec(typename V::Reg t) {
+  using Reg = typename V::Reg;
+  Reg linear = V::add(V::mul(t, V::set1(7.787)), V::set1(16.0 / 116));
+  return V::select_gt(t, V::set1(0.008856), cube_root_vec<V>(t), linear);
+}
+
+template <typename V, typename T>
+void rgb8_to_lab_vec(const unsigned char *red, const unsigned char *green, const unsigned char *blue,
+                     std::size_t stride, std::size_t n, const double *linear, T *l, T *a, T *b) {
+  using Reg = typename V::Reg;
+
+  int32_t ri[LAB_BLOCK];
+  int32_t gi[LAB_BLOCK];
+  int32_t bi[LAB_BLOCK];
+  T tail[3][V::width];
+
+  for (std::size_t begin = 0; begin < n; begin += LAB_BLOCK) {
+    std::size_t len = n - begin < LAB_BLOCK ? n - begin : LAB_BLOCK;
+    for (std::size_t j = 0; j < len; j++) {
+      ri[j] = red[(begin + j) * stride];
+      gi[j] = green[(begin + j) * stride];
+      bi[j] = blue[(begin + j) * stride];
+    }
+    // the last vector of a block is padded with black, its extra lanes are not stored
+    std::size_t padded = (len + V::width - 1) / V::width * V::width;
+    for (std::size_t j = len; j < padded; j++) {
+      ri[j] = gi[j] = bi[j] = 0;
+    }
+
+    for (std::size_t j = 0; j < padded; j += V::width) {
+      Reg r = V::gather(linear, ri + j);
+      Reg g = V::gather(linear, gi + j);
+      Reg bl = V::gather(linear, bi + j);
+
+      // sRGB to XYZ, scaled to the D65 white point
+      Reg x = V::add(V::add(V::mul(r, V::set1(0.4124)), V::mul(g, V::set1(0.3576))), V::mul(bl, V::set1(0.1805)));
+      Reg y = V::add(V::add(V::mul(r, V::set1(0.2126)), V::mul(g, V::set1(0.7152))), V::mul(bl, V::set1(0.0722)));
+      Reg z = V::add(V::add(V::mul(r, V::set1(0.0193)), V::mul(g, V::set1(0.1192))), V::mul(bl, V::set1(0.9505)));
+      Reg fx = lab_f_vec<V>(V::mul(x, V::set1(100 / 95.047)));
+      Reg fy = lab_f_vec<V>(y);
+      Reg fz = lab_f_vec<V>(V::mul(z, V::set1(100 / 108.883)));
+
+      Reg lab[3] = {V::sub(V::mul(fy, V::set1(116)), V::set1(16)), V::mul(V::sub(fx, fy), V::set1(500)),
+                    V::mul(V::sub(fy, fz), V::set1(200))};
+      T *out[3] = {l + begin + j, a + begin + j, b + begin + j};
+      if (j + V::width <= len) {
+        for (int c = 0; c < 3; c++) {
+          V::store(out[c], lab[c]);
+        }
+      } else {
+        for (int c = 0; c < 3; c++) {
+          V::store(tail[c], lab[c]);
+          for (std::size_t lane = 0; lane < len - j; lane++) {
+            out[c][lane] = tail[c][lane];
+          }
+        }
+      }
+    }
+  }
+}
+
+#define DEFINE_LAB_KERNELS(isa, V)                                                                                    \
+  void rgb8_to_lab_##isa(const unsigned char *red, const unsigned char *green, const unsigned char *blue,            \
+                         std::size_t stride, std::size_t n, const double *linear, double *l, double *a, double *b) { \
+    rgb8_to_lab_vec<V, double>(red, green, blue, stride, n, linear, l, a, b);                                          \
+  }                                                                                                                    \
+  void rgb8_to_lab_##isa(const unsigned char *red, const unsigned char *green, const unsigned char *blue,            \
+                         std::size_t stride, std::size_t n, const double *linear, float *l, float *a, float *b) {    \
+    rgb8_to_lab_vec<V, float>(red, green, blue, stride, n, linear, l, a, b);                                           \
+  }
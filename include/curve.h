@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class Curve {
+  none,    // keep the order the points were added in
+  morton,  // Z-order, interleaved coordinate bits
+  hilbert, // Hilbert curve, consecutive cells always share a face
+};
+
+/**
+ * Order of n points along a space-filling curve over their bounding box, so points close to each other end up close in
+ * memory. `channels` holds Dim pointers to the per-channel sample arrays. Each coordinate is quantized to
+ * 10 bits, points in the same cell keep their relative order. Returns the point indices in curve order,
+ * or the identity for Curve::none.
+ */
+template <int Dim, typename Scalar>
+std::vector<uint32_t> curve_order(const Scalar *const *channels, std::size_t n, Curve curve);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Kd-tree over weighted points for the filtering k-means engine (Kanungo et al.).
+ *
+ * Each node caches its bounding box and the weighted sum of its points. During an assignment pass candidate
+ * centroids are pruned per node, and once a single candidate is left the whole subtree is assigned to it and its
+ * cached sums are added without touching the points. Pruning is strict and leaf scans compare squared distances with
+ * ties going to the lowest index, so labels match the plain Lloyd assignment.
+ *
+ * The tree is cut into a fixed set of subtrees ("tasks") that can be filtered in parallel, each with its own partial
+ * sums, so results do not depend on the number of threads.
+ */
+template <int Dim, typename Scalar> class KdTree {
+private:
+  struct Node {
+    std::array<Scalar, Dim> lo;
+    std::array<Scalar, Dim> hi;
+    std::array<double, Dim> sum;
+    std::array<double, Dim> sum_sq;
+    std::size_t weight;
+    std::size_t begin;
+    std::size_t end;
+    int left;       // -1 for leaves
+    int right;      // -1 for leaves
+    uint32_t label; // label shared by every point of the subtree, or MIXED
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> order; // tree position to point index
+  std::array<std::vector<Scalar>, Dim> channels; // points in tree order
+  std::vector<uint32_t> weights;                  // weights in tree order
+  std::vector<int> roots;                         // subtree of each task
+  int max_depth;
+
+  int build(const Scalar *const *, const uint32_t *, std::size_t, std::size_t, int);
+  std::size_t filter(int, const uint32_t *, int, uint32_t *, const Scalar *, int, uint32_t *, double *, double *,
+                     std::size_t *, std::size_t &);
+  std::size_t relabel(int node, uint32_t label, uint32_t *labels);
+
+public:
+  // `label` is the label every point starts with.
+  KdTree(const Scalar *const *channels, const uint32_t *weights, std::size_t n, uint32_t label);
+
+  std::size_t tasks() const;
+
+  // Assign the points of one task to their nearest of k centroids, adding weighted sums, sums of squares (both k * Dim)
+  // and counts (k). Same return value and `distances` contract as DistanceBounds::assign().
+  std::size_t assign(std::size_t task, const Scalar *centroids, int k, uint32_t *labels, double *sums,
+                     double *sums_sq, std::size_t *counts, std::size_t &distances);
+};
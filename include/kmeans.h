@@ -1,28 +1,158 @@
 #pragma once
 
+#include "curve.h"
 #include "myrand.h"
 
 #include <array>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
-#include <unordered_set>
 #include <vector>
 
 using Point = std::vector<double>;
 
 struct Cluster {
   Point centroid;
-  std::unordered_set<const Point *> points;
+  std::size_t count;
+  std::vector<uint32_t> members; // only filled when requested
 };
 
+enum class Engine {
+  lloyd,     // full assignment pass every iteration
+  hamerly,   // one lower bound per point
+  elkan,     // one lower bound per point and centroid
+  bounds,    // hamerly for small k, elkan otherwise
+  kdtree,    // kd-tree filtering, prunes centroids per node
+  minibatch, // centroids learned from random batches, then one full labelling pass
+  bisecting, // repeatedly split the cluster with the largest squared error in two, Lloyd for warm starts
+  fixed,     // Lloyd over points quantized to int16, integer distances and int64 sums; FixedPoints bounds its error
+};
+
+enum class Seeding {
+  farthest, // point with the largest weighted distance summed over earlier seeds
+  kmeanspp, // k-means++ D^2 sampling
+  parallel, // k-means|| oversampling rounds, then weighted reclustering
+};
+
+enum class Repair {
+  split,    // split the cluster with the largest squared error along its widest spread
+  farthest, // move to the point furthest from its centroid, splitting when no such point is left; one O(n) scan per
+            // pass that has an empty cluster
+};
+
+struct KMeansOptions {
+  Engine engine = Engine::lloyd;
+  Seeding seeding = Seeding::kmeanspp;
+  Repair repair = Repair::split; // what an empty cluster is given
+  int threads = 1;       // 0 for one thread per hardware core
+  int batch_size = 1024; // points per batch for the minibatch engine
+  int max_iter = 300;    // cap on full passes, 0 for no cap
+  double tol = 0;        // stop once no centroid moves further than this, 0 to wait for stable labels
+  int restarts = 1;      // independent seeded runs, the one with the lowest inertia is kept
+};
+
+enum class Termination {
+  converged, // no label changed
+  tolerance, // centroids moved less than the tolerance
+  cycle,     // labels returned to an earlier assignment
+  max_iter,  // cut off by the iteration cap
+};
+
+struct KMeansStats {
+  int iterations = 0;        // full passes over the points
+  std::size_t batches = 0;   // mini-batch updates
+  std::size_t distances = 0; // point-to-centroid distance evaluations
+  std::size_t skipped = 0;   // evaluations saved compared to a full Lloyd pass
+  Termination termination = Termination::converged;
+  double inertia = 0; // weighted sum of squared distances to the assigned centroids
+  int abandoned = 0;  // restarts dropped early for falling behind
+};
+
+template <int Dim, typename Scalar = double> struct BasicCluster {
+  std::array<Scalar, Dim> centroid;
+  std::size_t count; // total weight of the member points
+  std::vector<uint32_t> members; // only filled when requested
+};
+
+/**
+ * K-means over points of a fixed dimension, stored as one contiguous array per channel.
+ * Each point carries an integer weight, so a histogram bin can stand in for every pixel that falls into it.
+ */
+template <int Dim, typename Scalar = double> class BasicKMeans {
+public:
+  using Sample = std::array<Scalar, Dim>;
+  using Cluster = BasicCluster<Dim, Scalar>;
+
+private:
+  std::array<std::vector<Scalar>, Dim> channels;
+  std::vector<uint32_t> weights;
+  std::vector<uint32_t> labels;
+  KMeansOptions options;
+  KMeansStats stats;
+
+  std::vector<Cluster> run(int, MyRand &, const std::vector<Sample> *, int, int, std::vector<uint32_t> &,
+                           KMeansStats &) const;
+  std::vector<Cluster> restart(int, MyRand &);
+  void fill_members(std::vector<Cluster> &) const;
+  bool repair(std::vector<Cluster> &, const std::vector<double> &, const std::vector<double> &, const Scalar *,
+              const std::vector<uint32_t> &, int) const;
+  void minibatch(std::vector<Cluster> &, MyRand &, KMeansStats &) const;
+  double squared_error(const std::vector<uint32_t> &, Cluster &) const;
+
+public:
+  BasicKMeans();
+  BasicKMeans(const std::vector<Point> &);
+
+  void reserve(std::size_t);
+  void push_back(const Sample &, uint32_t weight = 1);
+  std::size_t size() const;
+  const Scalar *channel(int) const;
+  const uint32_t *get_weights() const;
+  // Reorder the points along a space-filling curve, so similar points sit next to each other in memory and take the
+  // same branches while being assigned. Labels of earlier runs are dropped, as they follow the old order.
+  void sort(Curve);
+
+  void set_options(const KMeansOptions &);
+  const KMeansOptions &get_options() const;
+
+  std::vector<Cluster> cluster(int);
+  std::vector<Cluster> cluster(int, MyRand &, bool members = false);
+  // Warm start from the given centroids instead of seeding, restarts do not apply. Extra centroids beyond k are
+  // dropped, missing ones start empty and are repaired.
+  std::vector<Cluster> cluster(int, const std::vector<Sample> &, MyRand &, bool members = false);
+  // Bisecting k-means up to max_k clusters. Entry k - 1 holds the k clusters present after the first k - 1 splits, so
+  // one split tree gives every palette size; fewer entries come back when no cluster is left to split. Labels and
+  // stats are those of the last entry, `inertia` receives the inertia of every entry when given.
+  std::vector<std::vector<Cluster>> bisect(int max_k, MyRand &, std::vector<double> *inertia = nullptr);
+  // One run for each of the given k, side by side on the same points with threads shared out as for restarts, which
+  // do not apply here. The bisecting engine serves them all from one split tree. `stats` receives one entry per k,
+  // labels are left untouched.
+  std::vector<std::vector<Cluster>> cluster_each(const std::vector<int> &, MyRand &, std::vector<KMeansStats> &stats);
+  const std::vector<uint32_t> &get_labels() const;
+  const KMeansStats &get_stats() const;
+};
+
+/**
+ * Runtime-dimension front end, dispatching to BasicKMeans for dimensions 1 to 4.
+ */
 class KMeans {
 private:
   int dim;
   const std::vector<Point> &points;
-  double dist_sq(const Point &a, const Point &b);
+  std::vector<uint32_t> labels;
+  KMeansOptions options;
+  KMeansStats stats;
+
+  template <int Dim> std::vector<Cluster> cluster(int, const std::vector<Point> *, MyRand &, bool);
 
 public:
   KMeans(const std::vector<Point> &, int);
+  void set_options(const KMeansOptions &);
+  const KMeansOptions &get_options() const;
+
   std::vector<Cluster> cluster(int);
-  std::vector<Cluster> cluster(int, MyRand &);
+  std::vector<Cluster> cluster(int, MyRand &, bool members = false);
+  std::vector<Cluster> cluster(int, const std::vector<Point> &, MyRand &, bool members = false);
+  const std::vector<uint32_t> &get_labels() const;
+  const KMeansStats &get_stats() const;
 };
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Per-point distance bounds used by the Hamerly and Elkan k-means engines to skip distance evaluations that the
+ * triangle inequality proves cannot change a label.
+ *
+ * Hamerly keeps one upper bound and a single lower bound per point, Elkan keeps a lower bound per point and centroid.
+ * All pruning tests are strict and candidates are compared on squared distance with ties going to the lowest index,
+ * so labels match the plain Lloyd assignment.
+ */
+template <int Dim, typename Scalar> class DistanceBounds {
+private:
+  int k;
+  bool elkan;
+  bool fresh; // set until every point has had a full scan
+  std::vector<double> upper;
+  std::vector<double> lower;     // n for Hamerly, n * k for Elkan
+  std::vector<double> shift;     // how far each centroid moved in the last update
+  std::vector<double> half_min;  // half the distance from each centroid to its nearest other centroid
+  std::vector<double> half_dist; // half the distance between each pair of centroids, Elkan only
+  double max_shift;
+  double second_shift;
+  int max_shift_index;
+
+  std::size_t assign_hamerly(const Scalar *const *, std::size_t, std::size_t, const Scalar *, uint32_t *,
+                             std::size_t &);
+  std::size_t assign_elkan(const Scalar *const *, std::size_t, std::size_t, const Scalar *, uint32_t *,
+                           std::size_t &);
+
+public:
+  DistanceBounds(std::size_t n, int k, bool elkan);
+
+  // Record new centroid positions, `previous` is null for the initial seeds.
+  void move_centroids(const Scalar *previous, const Scalar *centroids);
+
+  // Same contract as assign_nearest(), also adding the number of distances evaluated onto `distances`.
+  std::size_t assign(const Scalar *const *channels, std::size_t begin, std::size_t end, const Scalar *centroids,
+                     uint32_t *labels, std::size_t &distances);
+};
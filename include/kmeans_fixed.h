@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Largest quantized coordinate: Dim squared differences of up to this size still sum within int32, and every
+// difference fits in int16.
+constexpr int32_t fixed_max(int dim) {
+  int32_t q = 32767;
+  while ((int64_t)dim * q * q > INT32_MAX) {
+    q--;
+  }
+  return q;
+}
+
+/**
+ * Points quantized to int16 for the fixed engine, which streams these instead of the Scalar channels during
+ * assignment passes and keeps its cluster sums in int64.
+ *
+ * Every channel is mapped onto [0, fixed_max(Dim)] with one common scale, `step` units per level, so distances keep
+ * their proportions. Rounding moves a coordinate by at most step / 2, which bounds the error the engine introduces:
+ *
+ * - each centroid is the exact mean of its quantized members, within sqrt(Dim) * step / 2 of the mean of the same
+ *   original points;
+ * - a point only goes to a centroid other than its nearest when that one is less than 2 * sqrt(Dim) * step further
+ *   away.
+ *
+ * For Lab points, spanning at most about 200 units, step is below 0.008 and a centroid stays within 0.007 units of the
+ * mean, two orders of magnitude below a just noticeable difference. Each pass is thus within these bounds of a Lloyd
+ * pass from the same centroids; over a whole run the near ties can still lead to a nearby local optimum, as a change
+ * of seed would. The int64 sums are exact up to a total weight of 2^48.
+ */
+template <int Dim, typename Scalar> class FixedPoints {
+private:
+  std::array<std::vector<int16_t>, Dim> channels;
+  const int16_t *pointers[Dim];
+  double low[Dim];
+  double scale; // levels per unit
+
+public:
+  FixedPoints(const Scalar *const *channels, std::size_t n);
+
+  const int16_t *const *data() const;
+  double step() const;
+
+  // Quantize k centroids (k * Dim, row-major), clamped to the grid.
+  void quantize(const Scalar *centroids, int k, int16_t *out) const;
+  // Weighted sums (Dim) of one cluster of total weight `count` in units, from its quantized sums. `sums_sq` holds the
+  // sums of squared quantized coordinates on entry and is converted in place.
+  void dequantize(const int64_t *fixed_sums, std::size_t count, double *sums, double *sums_sq) const;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Assign points [begin, end) to their nearest centroid, comparing squared distances.
+ *
+ * `channels` holds Dim pointers to the per-channel sample arrays, `centroids` is k * Dim values in row-major order.
+ * Labels are overwritten in place and the number of labels that changed is returned. When `min_dists` is not null it
+ * receives each point's squared distance to its new centroid. Ties go to the lowest centroid index.
+ */
+template <int Dim, typename Scalar>
+std::size_t assign_nearest(const Scalar *const *channels, std::size_t begin, std::size_t end, const Scalar *centroids,
+                           int k, uint32_t *labels, Scalar *min_dists = nullptr);
+
+/**
+ * Plain scalar version of assign_nearest(), kept to verify the vectorized kernel against.
+ */
+template <int Dim, typename Scalar>
+std::size_t assign_nearest_scalar(const Scalar *const *channels, std::size_t begin, std::size_t end,
+                                  const Scalar *centroids, int k, uint32_t *labels, Scalar *min_dists = nullptr);
+
+/**
+ * Add the (non-squared) distance from `centroid` to each point [begin, end) onto `dists`.
+ */
+template <int Dim, typename Scalar>
+void accumulate_dist(const Scalar *const *channels, std::size_t begin, std::size_t end, const Scalar *centroid,
+                     double *dists);
+
+template <int Dim, typename Scalar>
+void accumulate_dist_scalar(const Scalar *const *channels, std::size_t begin, std::size_t end,
+                            const Scalar *centroid, double *dists);
+
+/**
+ * assign_nearest() over points and centroids quantized to int16 for the fixed engine. Differences are taken in 16 bits
+ * and squared distances summed exactly in int32, so coordinates must lie within [0, fixed_max(Dim)].
+ */
+template <int Dim>
+std::size_t assign_nearest_fixed(const int16_t *const *channels, std::size_t begin, std::size_t end,
+                                 const int16_t *centroids, int k, uint32_t *labels);
+
+template <int Dim>
+std::size_t assign_nearest_fixed_scalar(const int16_t *const *channels, std::size_t begin, std::size_t end,
+                                        const int16_t *centroids, int k, uint32_t *labels);
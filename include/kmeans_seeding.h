@@ -0,0 +1,30 @@
+#pragma once
+
+#include "myrand.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Initial centroid strategies for BasicKMeans. Each takes the per-channel sample arrays and point weights, and returns
+ * at most k distinct seed points. Work is split into CHUNK-sized pieces so the seeds do not depend on `threads`.
+ */
+
+// Repeatedly pick the point with the largest weight times distance summed over all earlier seeds, starting from a
+// weighted random pick.
+template <int Dim, typename Scalar>
+std::vector<std::array<Scalar, Dim>> seed_farthest(const Scalar *const *channels, const uint32_t *weights,
+                                                   std::size_t n, int k, MyRand &rng, int threads);
+
+// k-means++: pick each seed with probability proportional to weight times squared distance to the nearest seed.
+template <int Dim, typename Scalar>
+std::vector<std::array<Scalar, Dim>> seed_kmeanspp(const Scalar *const *channels, const uint32_t *weights,
+                                                   std::size_t n, int k, MyRand &rng, int threads);
+
+// k-means|| (Bahmani et al.): a few rounds that each oversample about 2k candidates in parallel, then a weighted
+// k-means++ and Lloyd pass over the candidates to reduce them to k seeds.
+template <int Dim, typename Scalar>
+std::vector<std::array<Scalar, Dim>> seed_parallel(const Scalar *const *channels, const uint32_t *weights,
+                                                   std::size_t n, int k, MyRand &rng, int threads);
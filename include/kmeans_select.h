@@ -0,0 +1,31 @@
+#pragma once
+
+#include "kmeans.h"
+#include "myrand.h"
+
+#include <cstddef>
+#include <vector>
+
+enum class Criterion {
+  elbow,      // the k furthest below the straight line between the inertia of the smallest and the largest k
+  silhouette, // largest mean simplified silhouette, from the distances to the nearest and second nearest centroid
+  gap,        // smallest k whose gap statistic is within one standard error of the next one (Tibshirani et al.)
+};
+
+template <int Dim, typename Scalar> struct KSelection {
+  std::vector<int> ks;        // candidates in ascending order
+  std::vector<double> scores; // criterion value of each candidate, the elbow's is its distance below the line
+  std::vector<double> errors; // standard error of each gap statistic, empty for the other criteria
+  std::size_t chosen = 0;     // index of the picked candidate
+  std::vector<std::vector<BasicCluster<Dim, Scalar>>> clusters;
+  std::vector<KMeansStats> stats;
+};
+
+/**
+ * Cluster the points of `km` once for every k in [min_k, max_k], with the candidates running side by side, then pick
+ * one by the given criterion. The points are shared by every candidate; elbow and gap reuse the inertia each run
+ * already computes, only the silhouette takes one more pass per candidate.
+ */
+template <int Dim, typename Scalar>
+KSelection<Dim, Scalar> select_k(BasicKMeans<Dim, Scalar> &km, int min_k, int max_k, Criterion criterion,
+                                 MyRand &rng);
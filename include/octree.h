@@ -0,0 +1,48 @@
+#pragma once
+
+#include "color_space.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Octree color quantizer (Gervautz and Purgathofer).
+ *
+ * Pixels are streamed into an octree over the bits of their RGB channels, one level per bit. Whenever there are more
+ * than `max_leaves` leaves, the most recently created node of the deepest level is folded into a single leaf, so memory
+ * stays bounded however many pixels are added. reduce() then folds the lightest nodes of the deepest level until k
+ * leaves are left, merging single leaves into their closest sibling where a whole fold would leave fewer than k. Each
+ * leaf gives the mean color of its pixels.
+ */
+class Octree {
+private:
+  struct Node {
+    uint64_t sum[3];
+    std::size_t count; // pixels that passed through the node
+    int children[8];   // -1 where there is no child
+    bool leaf;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<int> free_nodes;
+  std::vector<std::vector<int>> reducible; // interior nodes of each level
+  std::size_t max_leaves;
+  std::size_t leaves;
+
+  int create(int level);
+  void fold(int);
+  void fold_deepest(bool lightest);
+  void merge_lightest(int);
+  int lightest(const std::vector<int> &) const;
+
+public:
+  Octree(std::size_t max_leaves);
+
+  // Add `n` interleaved 8-bit RGB pixels.
+  void add(const unsigned char *pixels, std::size_t n);
+
+  // Fold the tree down to at most k leaves and return their mean colors with pixel counts.
+  std::vector<std::pair<RGB, std::size_t>> reduce(int k);
+};
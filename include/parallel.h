@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * Call `fn(task)` for every task in [0, tasks) on up to `threads` threads, the calling thread included.
+ * Tasks are handed out in order but may finish in any order. The first exception thrown by a task is rethrown.
+ * Threads are started per call and never outnumber the tasks; starting one costs a few percent of a CHUNK-sized task
+ * (bench/threads.cpp), so a pool would not pay for itself.
+ */
+void parallel_for(int threads, std::size_t tasks, const std::function<void(std::size_t)> &fn);
+
+/**
+ * Resolve a thread count option, where 0 or less means one thread per hardware core.
+ */
+int thread_count(int threads);
+
+/**
+ * Size of the point chunks that parallel loops split their work into. Chunk boundaries never depend on the thread
+ * count, so per-chunk partial results are reduced in the same order however many threads run.
+ */
+const std::size_t CHUNK = 16384;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "color_space.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * Wu's variance minimizing color quantizer (Graphics Gems II).
+ *
+ * Pixels are counted into a histogram with BITS bits per RGB channel, whose cumulative moment tables (count, sums
+ * and sum of squares) give the size, mean and squared error of any box in constant time. reduce() then repeatedly
+ * splits the box with the largest squared error at the plane that leaves the least error behind. There is no
+ * randomness involved, the same pixels always give the same palette.
+ */
+class WuQuantizer {
+public:
+  static const int BITS = 5;
+
+private:
+  static const int SIDE = (1 << BITS) + 1; // one row of zeros in front of every axis
+
+  struct Box {
+    int lo[3]; // exclusive
+    int hi[3]; // inclusive
+  };
+
+  std::vector<int64_t> weight;
+  std::vector<int64_t> moment[3];
+  std::vector<double> moment2;
+  bool cumulative;
+
+  static std::size_t index(int r, int g, int b) { return ((std::size_t)r * SIDE + g) * SIDE + b; }
+  void accumulate();
+  template <typename T> T volume(const Box &, const std::vector<T> &) const;
+  template <typename T> T bottom(const Box &, int, const std::vector<T> &) const;
+  template <typename T> T top(const Box &, int, int, const std::vector<T> &) const;
+  double variance(const Box &) const;
+  double maximize(const Box &, int, int, int, int &, const int64_t *, int64_t) const;
+  bool cut(Box &, Box &) const;
+
+public:
+  WuQuantizer();
+
+  // Add `n` interleaved 8-bit RGB pixels, all pixels have to be added before reduce().
+  void add(const unsigned char *pixels, std::size_t n);
+
+  // Split the color space into at most k boxes and return their mean colors with pixel counts.
+  std::vector<std::pair<RGB, std::size_t>> reduce(int k);
+};
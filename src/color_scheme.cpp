@@ -2,63 +2,396 @@
 
 #include "color_scheme.h"
 #include "color_space.h"
+#include "curve.h"
 #include "kmeans.h"
+#include "kmeans_select.h"
 #include "myrand.h"
+#include "octree.h"
 #include "stb_image.h"
+#include "wu.h"
 
 #include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <memory>
+#include <numeric>
 #include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
+// leaves the octree quantizer keeps while streaming pixels, before it is reduced to the requested colors
+const std::size_t OCTREE_LEAVES = 4096;
+
+// Precision of the sample buffer, the color conversion and the k-means engine. Single precision halves the memory
+// traffic and doubles the SIMD width; centroid sums are accumulated in double either way.
+#ifdef COLOR_SCHEME_FLOAT32
+using Scalar = float;
+#else
+using Scalar = double;
+#endif
+
+// Oklab coordinates are multiplied by this while clustering, which brings them to about the range of Lab
+const double OKLAB_SCALE = 100;
+
+// Point in the clustering space for a color.
+template <typename T> std::array<T, 3> to_space(const BasicRGB<T> &rgb, Space space) {
+  if (space == Space::oklab) {
+    BasicOKLAB<T> oklab = rgb_to_oklab(rgb);
+    return {oklab.l * T(OKLAB_SCALE), oklab.a * T(OKLAB_SCALE), oklab.b * T(OKLAB_SCALE)};
+  } else if (space == Space::rgb) {
+    return {rgb.r, rgb.g, rgb.b};
+  }
+  BasicLAB<T> lab = rgb_to_lab(rgb);
+  return {lab.l, lab.a, lab.b};
+}
+
+// Color of a point in the clustering space, clamped to the sRGB gamut.
+template <typename T> RGB from_space(const std::array<T, 3> &point, Space space) {
+  if (space == Space::oklab) {
+    return oklab_to_rgb(OKLAB{point[0] / OKLAB_SCALE, point[1] / OKLAB_SCALE, point[2] / OKLAB_SCALE});
+  } else if (space == Space::rgb) {
+    return {std::min(std::max((double)point[0], 0.0), 255.0), std::min(std::max((double)point[1], 0.0), 255.0),
+            std::min(std::max((double)point[2], 0.0), 255.0)};
+  }
+  return lab_to_rgb(LAB{point[0], point[1], point[2]});
+}
+
+// Bin every pixel into a 3D RGB histogram with `bits` per channel and add one weighted point per occupied bin, placed
+// at the center of the bin. Bins are converted through `table` when given, otherwise into `space`.
+void histogram(const unsigned char *data, std::size_t pixels, int bits, const LabTable *table, Space space,
+               BasicKMeans<3, Scalar> &km) {
+  int shift = 8 - bits;
+  std::vector<uint32_t> bins((std::size_t)1 << (3 * bits), 0);
+  for (std::size_t i = 0; i < pixels; i++) {
+    const unsigned char *pixel = data + i * 3;
+    bins[((std::size_t)(pixel[0] >> shift) << (2 * bits)) | ((pixel[1] >> shift) << bits) | (pixel[2] >> shift)]++;
+  }
+
+  Scalar half = shift ? (1 << (shift - 1)) - Scalar(0.5) : 0;
+  std::size_t mask = ((std::size_t)1 << bits) - 1;
+  for (std::size_t bin = 0; bin < bins.size(); bin++) {
+    if (bins[bin]) {
+      BasicRGB<Scalar> rgb = {(Scalar)(((bin >> (2 * bits)) & mask) << shift) + half,
+                              (Scalar)(((bin >> bits) & mask) << shift) + half, (Scalar)((bin & mask) << shift) + half};
+      if (table) {
+        BasicLAB<Scalar> lab = table->convert(rgb);
+        km.push_back({lab.l, lab.a, lab.b}, bins[bin]);
+      } else {
+        km.push_back(to_space(rgb, space), bins[bin]);
+      }
+    }
+  }
+}
+
+// Points in `options.space` for k-means: every pixel through the histogram when `options.histogram_bits` is set,
+// otherwise `options.samples` random pixels, sorted along `options.order`. Returns the number of pixels the points
+// stand for.
+std::size_t load_points(const unsigned char *data, std::size_t pixels, const SchemeOptions &options, MyRand &rng,
+                        BasicKMeans<3, Scalar> &km) {
+  std::unique_ptr<LabTable> table;
+  if (!options.lab_table.empty()) {
+    if (options.space != Space::lab) {
+      throw std::runtime_error("error: lab table needs the lab space");
+    }
+    table.reset(new LabTable(options.lab_table, options.lab_table_cells));
+  }
+
+  std::size_t total = pixels;
+  if (options.histogram_bits) {
+    histogram(data, pixels, options.histogram_bits, table.get(), options.space, km);
+  } else if (options.space != Space::lab) {
+    km.reserve(options.samples);
+    for (int i = 0; i < options.samples; i++) {
+      std::size_t index = (std::size_t)rng.randint(0, pixels) * 3;
+      BasicRGB<Scalar> rgb = {(Scalar)data[index], (Scalar)data[index + 1], (Scalar)data[index + 2]};
+      km.push_back(to_space(rgb, options.space));
+    }
+    total = options.samples;
+  } else {
+    // gather the sampled pixels first, so they are converted in one batch
+    std::vector<unsigned char> sampled((std::size_t)options.samples * 3);
+    for (int i = 0; i < options.samples; i++) {
+      std::size_t index = (std::size_t)rng.randint(0, pixels) * 3;
+      std::copy(data + index, data + index + 3, &sampled[(std::size_t)i * 3]);
+    }
+    std::vector<Scalar> lab((std::size_t)options.samples * 3);
+    Scalar *l = lab.data();
+    Scalar *a = l + options.samples;
+    Scalar *b = a + options.samples;
+    if (table) {
+      table->convert(sampled.data(), options.samples, l, a, b);
+    } else {
+      rgb_to_lab(sampled.data(), options.samples, l, a, b);
+    }
+
+    km.reserve(options.samples);
+    for (int i = 0; i < options.samples; i++) {
+      km.push_back({l[i], a[i], b[i]});
+    }
+    total = options.samples;
+  }
+  km.sort(options.order);
+  return total;
+}
+
+// Scheme from a quantizer's palette of colors with pixel counts, largest share first.
+std::vector<std::pair<RGB, double>> palette_scheme(std::vector<std::pair<RGB, std::size_t>> palette,
+                                                   std::size_t total) {
+  std::sort(palette.begin(), palette.end(),
+            [](const std::pair<RGB, std::size_t> &a, const std::pair<RGB, std::size_t> &b) {
+              return a.second > b.second;
+            });
+
+  std::vector<std::pair<RGB, double>> results;
+  for (auto &color : palette) {
+    results.push_back({color.first, (double)color.second / total});
+  }
+  return results;
+}
+
 std::vector<std::pair<RGB, double>> color_scheme(const std::string &filename, int schemes, int samples) {
   MyRand rng;
   return color_scheme(filename, schemes, samples, rng);
 }
 
 std::vector<std::pair<RGB, double>> color_scheme(const std::string &filename, int clusters, int samples, MyRand &rng) {
-  if (clusters < 1) {
+  SchemeOptions options;
+  options.clusters = clusters;
+  options.samples = samples;
+  return color_scheme(filename, options, rng);
+}
+
+std::vector<std::pair<RGB, double>> color_scheme(const std::string &filename, const SchemeOptions &options,
+                                                 MyRand &rng, KMeansStats *stats) {
+  return color_scheme(filename, options, std::vector<RGB>(), rng, stats);
+}
+
+std::vector<std::pair<RGB, double>> color_scheme(const std::string &filename, const SchemeOptions &options,
+                                                 const std::vector<RGB> &initial, MyRand &rng, KMeansStats *stats) {
+  std::vector<KMeansStats> all_stats;
+  auto schemes = color_schemes(filename, options, {options.clusters}, initial, rng, &all_stats);
+  if (stats) {
+    *stats = all_stats[0];
+  }
+  return schemes[0];
+}
+
+// Scheme from k-means clusters over points in `space` standing for `total` pixels, largest share first.
+std::vector<std::pair<RGB, double>> cluster_scheme(std::vector<BasicKMeans<3, Scalar>::Cluster> clusters,
+                                                   std::size_t total, Space space) {
+  using Cluster = BasicKMeans<3, Scalar>::Cluster;
+  std::sort(clusters.begin(), clusters.end(), [](Cluster &a, Cluster &b) { return a.count > b.count; });
+
+  std::vector<std::pair<RGB, double>> results;
+  for (Cluster &cluster : clusters) {
+    if (cluster.count == 0) {
+      break;
+    }
+    results.push_back({from_space(cluster.centroid, space), (double)cluster.count / total});
+  };
+  return results;
+}
+
+std::vector<std::vector<std::pair<RGB, double>>> color_schemes(const std::string &filename,
+                                                               const SchemeOptions &options,
+                                                               const std::vector<int> &counts,
+                                                               const std::vector<RGB> &initial, MyRand &rng,
+                                                               std::vector<KMeansStats> *stats) {
+  int samples = options.samples;
+  int bits = options.histogram_bits;
+
+  if (counts.empty()) {
+    throw std::runtime_error("error: no number of clusters");
+  }
+  int max_clusters = *std::max_element(counts.begin(), counts.end());
+  if (*std::min_element(counts.begin(), counts.end()) < 1) {
     throw std::runtime_error("error: number of clusters must be positive");
   }
-  if (samples < 1) {
-    throw std::runtime_error("error: number of samples must be positive");
+  if (bits < 0 || bits > 8) {
+    throw std::runtime_error("error: histogram bits must be between 0 and 8");
+  }
+  if (!bits && options.quantizer == Quantizer::kmeans) {
+    if (samples < 1) {
+      throw std::runtime_error("error: number of samples must be positive");
+    }
+    if (max_clusters > samples) {
+      throw std::runtime_error("error: more clusters than samples");
+    }
   }
-  if (clusters > samples) {
-    throw std::runtime_error("error: more clusters than samples");
+
+  std::vector<std::vector<std::pair<RGB, double>>> schemes(counts.size());
+  if (stats) {
+    stats->assign(counts.size(), KMeansStats());
   }
 
-  std::vector<Point> points;
+  BasicKMeans<3, Scalar> km;
+  km.set_options(options.kmeans);
+  std::size_t total;
+  // Wu seeds for each requested count, unless the caller gave initial centroids
+  std::vector<std::vector<RGB>> wu_seeds;
   {
     int x, y, n;
     unsigned char *data = stbi_load(filename.c_str(), &x, &y, &n, STBI_rgb);
     if (!data) {
       throw std::runtime_error("error: failed to open file \"" + filename + "\"");
     }
-    for (int i = 0; i < samples; i++) {
-      int index = rng.randint(0, x * y) * 3;
-      RGB rgb = {(double)data[index], (double)data[index + 1], (double)data[index + 2]};
-      LAB lab = rgb_to_lab(rgb);
-      points.push_back({lab.l, lab.a, lab.b});
+
+    std::size_t pixels = (std::size_t)x * y;
+    if (options.quantizer == Quantizer::octree) {
+      Octree octree(std::max(OCTREE_LEAVES, (std::size_t)max_clusters));
+      octree.add(data, pixels);
+      stbi_image_free(data);
+
+      // reducing only ever merges colors, so the counts are served from the largest down
+      std::vector<std::size_t> order(counts.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return counts[a] > counts[b]; });
+      for (std::size_t i : order) {
+        schemes[i] = palette_scheme(octree.reduce(counts[i]), pixels);
+      }
+      return schemes;
+    } else if (options.quantizer == Quantizer::wu) {
+      WuQuantizer wu;
+      wu.add(data, pixels);
+      stbi_image_free(data);
+      for (std::size_t i = 0; i < counts.size(); i++) {
+        schemes[i] = palette_scheme(wu.reduce(counts[i]), pixels);
+      }
+      return schemes;
+    }
+
+    if (options.wu_seeding && initial.empty()) {
+      WuQuantizer wu;
+      wu.add(data, pixels);
+      for (int count : counts) {
+        wu_seeds.emplace_back();
+        for (auto &color : wu.reduce(count)) {
+          wu_seeds.back().push_back(color.first);
+        }
+      }
     }
+
+    total = load_points(data, pixels, options, rng, km);
     stbi_image_free(data);
   }
 
-  KMeans km(points, 3);
+  // a histogram of a few-color image can have fewer occupied bins than clusters asked for, every bin then gets a
+  // cluster of its own and the palette comes out shorter, as it does when sampled
+  auto clamp_k = [&](int k) { return (int)std::min<std::size_t>(k, km.size()); };
+
+  // without a warm start, the bisecting engine reads every count off a single split tree
+  if (options.kmeans.engine == Engine::bisecting && initial.empty() && wu_seeds.empty()) {
+    std::vector<double> inertia;
+    auto levels = km.bisect(clamp_k(max_clusters), rng, &inertia);
+    for (std::size_t i = 0; i < counts.size(); i++) {
+      std::size_t level = std::min<std::size_t>(counts[i], levels.size()) - 1;
+      schemes[i] = cluster_scheme(levels[level], total, options.space);
+      if (stats) {
+        (*stats)[i] = km.get_stats();
+        (*stats)[i].inertia = inertia[level];
+      }
+    }
+    return schemes;
+  }
 
-  std::vector<Cluster> output = km.cluster(clusters, rng);
+  for (std::size_t i = 0; i < counts.size(); i++) {
+    const std::vector<RGB> &seeds = wu_seeds.empty() ? initial : wu_seeds[i];
+    std::vector<BasicKMeans<3, Scalar>::Cluster> clusters;
+    if (seeds.empty()) {
+      clusters = km.cluster(clamp_k(counts[i]), rng);
+    } else {
+      std::vector<BasicKMeans<3, Scalar>::Sample> centroids;
+      for (const RGB &rgb : seeds) {
+        std::array<double, 3> point = to_space(rgb, options.space);
+        centroids.push_back({(Scalar)point[0], (Scalar)point[1], (Scalar)point[2]});
+      }
+      clusters = km.cluster(clamp_k(counts[i]), centroids, rng);
+    }
+    if (stats) {
+      (*stats)[i] = km.get_stats();
+    }
+    schemes[i] = cluster_scheme(std::move(clusters), total, options.space);
+  }
 
-  std::sort(output.begin(), output.end(), [](Cluster &a, Cluster &b) { return a.points.size() > b.points.size(); });
+  return schemes;
+}
 
-  std::vector<std::pair<RGB, double>> results;
-  for (Cluster &cluster : output) {
-    if (cluster.points.empty()) {
-      break;
+std::vector<std::pair<RGB, double>> auto_color_scheme(const std::string &filename, const SchemeOptions &options,
+                                                      int min, int max, MyRand &rng, ClusterChoice *choice) {
+  if (options.quantizer != Quantizer::kmeans) {
+    throw std::runtime_error("error: automatic number of clusters needs k-means");
+  }
+  if (options.wu_seeding) {
+    throw std::runtime_error("error: automatic number of clusters cannot be seeded by wu");
+  }
+  if (min < 1 || max < min) {
+    throw std::runtime_error("error: invalid range of clusters");
+  }
+  if (options.histogram_bits < 0 || options.histogram_bits > 8) {
+    throw std::runtime_error("error: histogram bits must be between 0 and 8");
+  }
+  if (!options.histogram_bits) {
+    if (options.samples < 1) {
+      throw std::runtime_error("error: number of samples must be positive");
     }
-    LAB lab = {cluster.centroid[0], cluster.centroid[1], cluster.centroid[2]};
-    RGB rgb = lab_to_rgb(lab);
-    results.push_back({rgb, (double)cluster.points.size() / samples});
-  };
+    if (max > options.samples) {
+      throw std::runtime_error("error: more clusters than samples");
+    }
+  }
 
-  return results;
+  BasicKMeans<3, Scalar> km;
+  km.set_options(options.kmeans);
+  std::size_t total;
+  {
+    int x, y, n;
+    unsigned char *data = stbi_load(filename.c_str(), &x, &y, &n, STBI_rgb);
+    if (!data) {
+      throw std::runtime_error("error: failed to open file \"" + filename + "\"");
+    }
+    total = load_points(data, (std::size_t)x * y, options, rng, km);
+    stbi_image_free(data);
+  }
+
+  // fewer occupied histogram bins than candidates: the range is cut down to the bins there are
+  max = (int)std::min<std::size_t>(max, km.size());
+  min = std::min(min, max);
+
+  auto selection = select_k(km, min, max, options.criterion, rng);
+  if (choice) {
+    choice->counts = selection.ks;
+    choice->scores = selection.scores;
+    choice->errors = selection.errors;
+    choice->stats = selection.stats;
+    choice->chosen = selection.chosen;
+  }
+  return cluster_scheme(std::move(selection.clusters[selection.chosen]), total, options.space);
+}
+
+std::vector<RGB> read_palette(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    throw std::runtime_error("error: failed to open palette \"" + filename + "\"");
+  }
+
+  std::vector<RGB> palette;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::size_t hash = line.find('#');
+    if (hash == std::string::npos) {
+      continue;
+    }
+    std::string hex = line.substr(hash + 1, 6);
+    if (hex.size() != 6 || !std::all_of(hex.begin(), hex.end(), [](unsigned char c) { return std::isxdigit(c); })) {
+      throw std::runtime_error("error: malformed palette line \"" + line + "\"");
+    }
+    unsigned long value = std::stoul(hex, nullptr, 16);
+    palette.push_back({(double)((value >> 16) & 0xff), (double)((value >> 8) & 0xff), (double)(value & 0xff)});
+  }
+
+  if (palette.empty()) {
+    throw std::runtime_error("error: no colors in palette \"" + filename + "\"");
+  }
+  return palette;
 }
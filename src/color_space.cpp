@@ -1,6 +1,24 @@
 #include "color_space.h"
+#include "color_space_batch.h"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define COLOR_SCHEME_MMAP
+#endif
 
 const double PI = 3.1415926535897932354626;
 
@@ -47,81 +65,244 @@ double aHpF(double C1, double C2, double h1p, double h2p) {
   return 0;
 }
 
-XYZ rgb_to_xyz(const RGB &rgb) {
-  double r = rgb.r / 255.0;
-  double g = rgb.g / 255.0;
-  double b = rgb.b / 255.0;
+#ifndef COLOR_SCHEME_EXACT_LAB
+// x^(1/5) for x in (0, 1], by Newton's method from above so it can run in a constant expression
+constexpr double fifth_root(double x) {
+  double y = 1;
+  for (int i = 0; i < 100; i++) {
+    double y4 = y * y * y * y;
+    double next = y - (y4 * y - x) / (5 * y4);
+    if (next >= y) {
+      break;
+    }
+    y = next;
+  }
+  return y;
+}
 
-  r = r > 0.04045 ? pow((r + 0.055) / 1.055, 2.4) : r / 12.92;
-  g = g > 0.04045 ? pow((g + 0.055) / 1.055, 2.4) : g / 12.92;
-  b = b > 0.04045 ? pow((b + 0.055) / 1.055, 2.4) : b / 12.92;
+// sRGB decoding of every 8-bit channel value, with s^2.4 taken as s^2 times the fifth root of s^2
+constexpr std::array<double, 256> linear_table() {
+  std::array<double, 256> table{};
+  for (int i = 0; i < 256; i++) {
+    double c = i / 255.0;
+    double s = (c + 0.055) / 1.055;
+    table[i] = c > 0.04045 ? s * s * fifth_root(s * s) : c / 12.92;
+  }
+  return table;
+}
 
-  double x = r * 0.4124 + g * 0.3576 + b * 0.1805;
-  double y = r * 0.2126 + g * 0.7152 + b * 0.0722;
-  double z = r * 0.0193 + g * 0.1192 + b * 0.9505;
+constexpr std::array<double, 256> LINEAR = linear_table();
+
+// Cube root of x > 0 for normal x. Dividing the exponent bits by three gives an estimate within 3.3% of the root,
+// two Halley steps then bring it within 1e-14 (relative) over the range xyz_to_lab needs.
+double cube_root(double x) {
+  uint64_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  bits = bits / 3 + 0x2A9F789300000000ull;
+  double y;
+  std::memcpy(&y, &bits, sizeof(y));
+  for (int i = 0; i < 2; i++) {
+    double y3 = y * y * y;
+    y *= (y3 + 2 * x) / (2 * y3 + x);
+  }
+  return y;
+}
+#endif
+
+// sRGB decoding of a channel in [0, 255]. Unless COLOR_SCHEME_EXACT_LAB is defined, whole values, which is what
+// sampled pixels are, come from a table; histogram bin centers in between take the exact path.
+template <typename T> T linearize(T c) {
+#ifndef COLOR_SCHEME_EXACT_LAB
+  if (c >= 0 && c <= 255 && (T)(int)c == c) {
+    return (T)LINEAR[(int)c];
+  }
+#endif
+  c /= T(255.0);
+  return c > T(0.04045) ? std::pow((c + T(0.055)) / T(1.055), T(2.4)) : c / T(12.92);
+}
 
-  return {x * 100, y * 100, z * 100};
+// Cube root on the part of the Lab transfer function above the linear segment.
+template <typename T> T lab_root(T x) {
+#ifdef COLOR_SCHEME_EXACT_LAB
+  return std::pow(x, T(1.0 / 3));
+#else
+  return (T)cube_root(x);
+#endif
 }
 
-RGB xyz_to_rgb(const XYZ &xyz) {
-  double x = xyz.x / 100.0;
-  double y = xyz.y / 100.0;
-  double z = xyz.z / 100.0;
+// sRGB encoding of a linear channel, clamped to [0, 255].
+template <typename T> T delinearize(T c) {
+  c = c > T(0.0031308) ? T(1.055) * std::pow(c, T(1.0 / 2.4)) - T(0.055) : c * T(12.92);
+  c = c < 0 ? 0 : (c > 1 ? 1 : c);
+  return c * 255;
+}
 
-  double r = x * 3.2406 + y * -1.5372 + z * -0.4986;
-  double g = x * -0.9689 + y * 1.8758 + z * 0.0415;
-  double b = x * 0.0557 + y * -0.204 + z * 1.057;
+template <typename T> BasicXYZ<T> rgb_to_xyz(const BasicRGB<T> &rgb) {
+  T r = linearize(rgb.r);
+  T g = linearize(rgb.g);
+  T b = linearize(rgb.b);
 
-  r = r > 0.0031308 ? 1.055 * pow(r, 1.0 / 2.4) - 0.055 : r * 12.92;
-  g = g > 0.0031308 ? 1.055 * pow(g, 1.0 / 2.4) - 0.055 : g * 12.92;
-  b = b > 0.0031308 ? 1.055 * pow(b, 1.0 / 2.4) - 0.055 : b * 12.92;
+  T x = r * T(0.4124) + g * T(0.3576) + b * T(0.1805);
+  T y = r * T(0.2126) + g * T(0.7152) + b * T(0.0722);
+  T z = r * T(0.0193) + g * T(0.1192) + b * T(0.9505);
 
-  r = r < 0 ? 0 : (r > 1 ? 1 : r);
-  g = g < 0 ? 0 : (g > 1 ? 1 : g);
-  b = b < 0 ? 0 : (b > 1 ? 1 : b);
+  return {x * 100, y * 100, z * 100};
+}
+
+template <typename T> BasicRGB<T> xyz_to_rgb(const BasicXYZ<T> &xyz) {
+  T x = xyz.x / T(100.0);
+  T y = xyz.y / T(100.0);
+  T z = xyz.z / T(100.0);
 
-  return {r * 255, g * 255, b * 255};
+  T r = x * T(3.2406) + y * T(-1.5372) + z * T(-0.4986);
+  T g = x * T(-0.9689) + y * T(1.8758) + z * T(0.0415);
+  T b = x * T(0.0557) + y * T(-0.204) + z * T(1.057);
+
+  return {delinearize(r), delinearize(g), delinearize(b)};
 }
 
-LAB xyz_to_lab(const XYZ &xyz) {
-  double x = xyz.x / 95.047;
-  double y = xyz.y / 100.0;
-  double z = xyz.z / 108.883;
+template <typename T> BasicLAB<T> xyz_to_lab(const BasicXYZ<T> &xyz) {
+  T x = xyz.x / T(95.047);
+  T y = xyz.y / T(100.0);
+  T z = xyz.z / T(108.883);
 
-  x = x > 0.008856 ? pow(x, 1.0 / 3) : 7.787 * x + 16.0 / 116;
-  y = y > 0.008856 ? pow(y, 1.0 / 3) : 7.787 * y + 16.0 / 116;
-  z = z > 0.008856 ? pow(z, 1.0 / 3) : 7.787 * z + 16.0 / 116;
+  x = x > T(0.008856) ? lab_root(x) : T(7.787) * x + T(16.0 / 116);
+  y = y > T(0.008856) ? lab_root(y) : T(7.787) * y + T(16.0 / 116);
+  z = z > T(0.008856) ? lab_root(z) : T(7.787) * z + T(16.0 / 116);
 
-  double l = 116 * y - 16;
-  double a = 500 * (x - y);
-  double b = 200 * (y - z);
+  T l = 116 * y - 16;
+  T a = 500 * (x - y);
+  T b = 200 * (y - z);
 
   return {l, a, b};
 }
 
-XYZ lab_to_xyz(const LAB &lab) {
-  double y = (lab.l + 16) / 116;
-  double x = lab.a / 500 + y;
-  double z = y - lab.b / 200;
+template <typename T> BasicXYZ<T> lab_to_xyz(const BasicLAB<T> &lab) {
+  T y = (lab.l + 16) / 116;
+  T x = lab.a / 500 + y;
+  T z = y - lab.b / 200;
 
-  double y2 = pow(y, 3);
-  double x2 = pow(x, 3);
-  double z2 = pow(z, 3);
+  T y2 = std::pow(y, T(3));
+  T x2 = std::pow(x, T(3));
+  T z2 = std::pow(z, T(3));
 
-  y = y2 > 0.008856 ? y2 : (y - 16.0 / 116) / 7.787;
-  x = x2 > 0.008856 ? x2 : (x - 16.0 / 116) / 7.787;
-  z = z2 > 0.008856 ? z2 : (z - 16.0 / 116) / 7.787;
+  y = y2 > T(0.008856) ? y2 : (y - T(16.0 / 116)) / T(7.787);
+  x = x2 > T(0.008856) ? x2 : (x - T(16.0 / 116)) / T(7.787);
+  z = z2 > T(0.008856) ? z2 : (z - T(16.0 / 116)) / T(7.787);
 
-  x *= 95.047;
+  x *= T(95.047);
   y *= 100;
-  z *= 108.883;
+  z *= T(108.883);
 
   return {x, y, z};
 }
 
-LAB rgb_to_lab(const RGB &rgb) { return xyz_to_lab(rgb_to_xyz(rgb)); }
+template <typename T> BasicLAB<T> rgb_to_lab(const BasicRGB<T> &rgb) { return xyz_to_lab(rgb_to_xyz(rgb)); }
+
+template <typename T> BasicRGB<T> lab_to_rgb(const BasicLAB<T> &lab) { return xyz_to_rgb(lab_to_xyz(lab)); }
 
-RGB lab_to_rgb(const LAB &lab) { return xyz_to_rgb(lab_to_xyz(lab)); }
+LAB rgb_to_lab(const RGB &rgb) { return rgb_to_lab<double>(rgb); }
+
+RGB lab_to_rgb(const LAB &lab) { return lab_to_rgb<double>(lab); }
+
+// the vectorized batch kernels are built for x86 only, and use the decoding table the exact path does without
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(COLOR_SCHEME_EXACT_LAB)
+#define COLOR_SCHEME_LAB_KERNELS
+#endif
+
+template <typename T>
+using LabKernel = void (*)(const unsigned char *, const unsigned char *, const unsigned char *, std::size_t,
+                           std::size_t, const double *, T *, T *, T *);
+
+// The kernel for the widest instruction set the CPU supports, null when there is none.
+template <typename T> LabKernel<T> lab_kernel() {
+#ifdef COLOR_SCHEME_LAB_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return rgb8_to_lab_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return rgb8_to_lab_avx2;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    return rgb8_to_lab_sse41;
+  }
+#endif
+  return nullptr;
+}
+
+template <typename T>
+void rgb_to_lab(const unsigned char *red, const unsigned char *green, const unsigned char *blue, std::size_t stride,
+                std::size_t n, T *l, T *a, T *b) {
+#ifdef COLOR_SCHEME_LAB_KERNELS
+  static const LabKernel<T> kernel = lab_kernel<T>();
+  if (kernel) {
+    kernel(red, green, blue, stride, n, LINEAR.data(), l, a, b);
+    return;
+  }
+#endif
+  for (std::size_t j = 0; j < n; j++) {
+    BasicLAB<T> lab = rgb_to_lab(BasicRGB<T>{(T)red[j * stride], (T)green[j * stride], (T)blue[j * stride]});
+    l[j] = lab.l;
+    a[j] = lab.a;
+    b[j] = lab.b;
+  }
+}
+
+template <typename T> void rgb_to_lab(const unsigned char *rgb, std::size_t n, T *l, T *a, T *b) {
+  rgb_to_lab(rgb, rgb + 1, rgb + 2, 3, n, l, a, b);
+}
+
+// Cube root of a linear LMS response, which is never negative for colors inside the sRGB gamut.
+template <typename T> T oklab_root(T x) {
+#ifdef COLOR_SCHEME_EXACT_LAB
+  return std::cbrt(x);
+#else
+  return x > 0 ? (T)cube_root(x) : std::cbrt(x);
+#endif
+}
+
+template <typename T> BasicOKLAB<T> rgb_to_oklab(const BasicRGB<T> &rgb) {
+  T r = linearize(rgb.r);
+  T g = linearize(rgb.g);
+  T b = linearize(rgb.b);
+
+  T l = oklab_root(T(0.4122214708) * r + T(0.5363325363) * g + T(0.0514459929) * b);
+  T m = oklab_root(T(0.2119034982) * r + T(0.6806995451) * g + T(0.1073969566) * b);
+  T s = oklab_root(T(0.0883024619) * r + T(0.2817188376) * g + T(0.6299787005) * b);
+
+  return {T(0.2104542553) * l + T(0.7936177850) * m - T(0.0040720468) * s,
+          T(1.9779984951) * l - T(2.4285922050) * m + T(0.4505937099) * s,
+          T(0.0259040371) * l + T(0.7827717662) * m - T(0.8086757660) * s};
+}
+
+template <typename T> BasicRGB<T> oklab_to_rgb(const BasicOKLAB<T> &oklab) {
+  T l = oklab.l + T(0.3963377774) * oklab.a + T(0.2158037573) * oklab.b;
+  T m = oklab.l - T(0.1055613458) * oklab.a - T(0.0638541728) * oklab.b;
+  T s = oklab.l - T(0.0894841775) * oklab.a - T(1.2914855480) * oklab.b;
+  l = l * l * l;
+  m = m * m * m;
+  s = s * s * s;
+
+  T r = T(4.0767416621) * l - T(3.3077115913) * m + T(0.2309699292) * s;
+  T g = T(-1.2684380046) * l + T(2.6097574011) * m - T(0.3413193965) * s;
+  T b = T(-0.0041960863) * l - T(0.7034186147) * m + T(1.7076147010) * s;
+
+  return {delinearize(r), delinearize(g), delinearize(b)};
+}
+
+template BasicLAB<double> rgb_to_lab(const BasicRGB<double> &);
+template BasicRGB<double> lab_to_rgb(const BasicLAB<double> &);
+template BasicLAB<float> rgb_to_lab(const BasicRGB<float> &);
+template BasicRGB<float> lab_to_rgb(const BasicLAB<float> &);
+template BasicOKLAB<double> rgb_to_oklab(const BasicRGB<double> &);
+template BasicRGB<double> oklab_to_rgb(const BasicOKLAB<double> &);
+template BasicOKLAB<float> rgb_to_oklab(const BasicRGB<float> &);
+template BasicRGB<float> oklab_to_rgb(const BasicOKLAB<float> &);
+template void rgb_to_lab(const unsigned char *, const unsigned char *, const unsigned char *, std::size_t, std::size_t,
+                         double *, double *, double *);
+template void rgb_to_lab(const unsigned char *, const unsigned char *, const unsigned char *, std::size_t, std::size_t,
+                         float *, float *, float *);
+template void rgb_to_lab(const unsigned char *, std::size_t, double *, double *, double *);
+template void rgb_to_lab(const unsigned char *, std::size_t, float *, float *, float *);
 
 double color_diff(const LAB &lab1, const LAB &lab2) {
   double L1 = lab1.l;
@@ -184,3 +365,202 @@ double color_diff(const LAB &lab1, const LAB &lab2) {
                    RT * (dCp / (SC * kC)) * (dHp / (SH * kH))); // (22)
   return dE;
 }
+
+// Bumped whenever the conversion or the file layout changes, so tables written by older builds get rebuilt. Build
+// options stay out of the header: build() always stores the double conversion rounded to float, where the exact_lab
+// path differs by far less than float precision, so every build shares one table.
+const uint32_t LAB_TABLE_VERSION = 3;
+const char LAB_TABLE_MAGIC[8] = {'L', 'A', 'B', 'G', 'R', 'I', 'D', 0};
+
+struct LabTableHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t cells;
+  uint64_t checksum; // FNV-1a over the grid's 32-bit words
+};
+
+uint64_t grid_checksum(const float *grid, std::size_t values) {
+  uint64_t hash = 14695981039346656037ull;
+  for (std::size_t i = 0; i < values; i++) {
+    uint32_t word;
+    std::memcpy(&word, grid + i, sizeof(word));
+    hash = (hash ^ word) * 1099511628211ull;
+  }
+  return hash;
+}
+
+std::size_t grid_values(int cells) { return (std::size_t)(cells + 1) * (cells + 1) * (cells + 1) * 3; }
+
+LabTable::LabTable(const std::string &path, int cells)
+    : cells(cells), grid(nullptr), mapping(nullptr), mapping_size(0) {
+  if (cells < 1 || cells > 255) {
+    throw std::runtime_error("error: lab table cells must be between 1 and 255");
+  }
+  for (int v = 0; v < 256; v++) {
+    // the top value falls at the far end of the last cell, so the node after a cell always exists
+    float position = (float)v * cells / 255;
+    cell[v] = std::min((uint32_t)position, (uint32_t)cells - 1);
+    weight[v] = position - cell[v];
+  }
+
+  if (!open(path)) {
+    build(path);
+    if (!open(path)) {
+      throw std::runtime_error("error: failed to load lab table \"" + path + "\"");
+    }
+  }
+}
+
+LabTable::~LabTable() {
+#ifdef COLOR_SCHEME_MMAP
+  if (mapping) {
+    munmap(mapping, mapping_size);
+  }
+#endif
+}
+
+// Map or read the table at `path`, false when it is missing or stale.
+bool LabTable::open(const std::string &path) {
+  std::size_t values = grid_values(cells);
+  std::size_t size = sizeof(LabTableHeader) + values * sizeof(float);
+  const LabTableHeader *header;
+
+#ifdef COLOR_SCHEME_MMAP
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (std::size_t)st.st_size == size) {
+    map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  header = (const LabTableHeader *)map;
+  grid = (const float *)((const char *)map + sizeof(LabTableHeader));
+#else
+  std::ifstream file(path, std::ios::binary);
+  LabTableHeader read_header;
+  owned.resize(values);
+  if (!file.read((char *)&read_header, sizeof(read_header)) ||
+      !file.read((char *)owned.data(), values * sizeof(float)) || file.peek() != EOF) {
+    return false;
+  }
+  header = &read_header;
+  grid = owned.data();
+#endif
+
+  if (std::memcmp(header->magic, LAB_TABLE_MAGIC, sizeof(LAB_TABLE_MAGIC)) || header->version != LAB_TABLE_VERSION ||
+      header->cells != (uint32_t)cells || header->checksum != grid_checksum(grid, values)) {
+#ifdef COLOR_SCHEME_MMAP
+    munmap(map, size);
+#endif
+    grid = nullptr;
+    return false;
+  }
+
+#ifdef COLOR_SCHEME_MMAP
+  mapping = map;
+  mapping_size = size;
+#endif
+  return true;
+}
+
+// Write a fresh table next to `path` and move it into place, so other processes never see a partial file.
+void LabTable::build(const std::string &path) const {
+  std::vector<float> nodes(grid_values(cells));
+  std::size_t i = 0;
+  for (int r = 0; r <= cells; r++) {
+    for (int g = 0; g <= cells; g++) {
+      for (int b = 0; b <= cells; b++) {
+        LAB lab = rgb_to_lab(RGB{255.0 * r / cells, 255.0 * g / cells, 255.0 * b / cells});
+        nodes[i++] = (float)lab.l;
+        nodes[i++] = (float)lab.a;
+        nodes[i++] = (float)lab.b;
+      }
+    }
+  }
+
+  LabTableHeader header = {};
+  std::memcpy(header.magic, LAB_TABLE_MAGIC, sizeof(LAB_TABLE_MAGIC));
+  header.version = LAB_TABLE_VERSION;
+  header.cells = cells;
+  header.checksum = grid_checksum(nodes.data(), nodes.size());
+
+#ifdef COLOR_SCHEME_MMAP
+  std::string temp = path + "." + std::to_string(getpid()) + ".tmp";
+#else
+  std::string temp = path + ".tmp";
+#endif
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)nodes.data(), nodes.size() * sizeof(float));
+    if (!file) {
+      std::remove(temp.c_str());
+      throw std::runtime_error("error: failed to write lab table \"" + path + "\"");
+    }
+  }
+#ifndef COLOR_SCHEME_MMAP
+  std::remove(path.c_str()); // rename does not replace an existing file everywhere
+#endif
+  if (std::rename(temp.c_str(), path.c_str())) {
+    std::remove(temp.c_str());
+    throw std::runtime_error("error: failed to write lab table \"" + path + "\"");
+  }
+}
+
+// Trilinear interpolation inside the cell with lowest node (r, g, b), at fractions (fr, fg, fb) along each axis.
+BasicLAB<float> LabTable::interpolate(uint32_t r, uint32_t g, uint32_t b, float fr, float fg, float fb) const {
+  std::size_t side = cells + 1;
+  std::size_t stride_b = 3;
+  std::size_t stride_g = side * 3;
+  std::size_t stride_r = side * side * 3;
+  const float *p = grid + r * stride_r + g * stride_g + b * stride_b;
+
+  float out[3];
+  for (int c = 0; c < 3; c++) {
+    float c00 = p[c] + (p[stride_b + c] - p[c]) * fb;
+    float c01 = p[stride_g + c] + (p[stride_g + stride_b + c] - p[stride_g + c]) * fb;
+    float c10 = p[stride_r + c] + (p[stride_r + stride_b + c] - p[stride_r + c]) * fb;
+    float c11 = p[stride_r + stride_g + c] + (p[stride_r + stride_g + stride_b + c] - p[stride_r + stride_g + c]) * fb;
+    float c0 = c00 + (c01 - c00) * fg;
+    float c1 = c10 + (c11 - c10) * fg;
+    out[c] = c0 + (c1 - c0) * fr;
+  }
+  return {out[0], out[1], out[2]};
+}
+
+int LabTable::get_cells() const { return cells; }
+
+template <typename T> BasicLAB<T> LabTable::convert(const BasicRGB<T> &rgb) const {
+  uint32_t index[3];
+  float frac[3];
+  T channels[3] = {rgb.r, rgb.g, rgb.b};
+  for (int c = 0; c < 3; c++) {
+    float position = std::min(std::max((float)channels[c], 0.0f), 255.0f) * cells / 255;
+    index[c] = std::min((uint32_t)position, (uint32_t)cells - 1);
+    frac[c] = position - index[c];
+  }
+  BasicLAB<float> lab = interpolate(index[0], index[1], index[2], frac[0], frac[1], frac[2]);
+  return {(T)lab.l, (T)lab.a, (T)lab.b};
+}
+
+template <typename T> void LabTable::convert(const unsigned char *rgb, std::size_t n, T *l, T *a, T *b) const {
+  for (std::size_t j = 0; j < n; j++) {
+    const unsigned char *pixel = rgb + j * 3;
+    BasicLAB<float> lab = interpolate(cell[pixel[0]], cell[pixel[1]], cell[pixel[2]], weight[pixel[0]],
+                                      weight[pixel[1]], weight[pixel[2]]);
+    l[j] = lab.l;
+    a[j] = lab.a;
+    b[j] = lab.b;
+  }
+}
+
+template BasicLAB<double> LabTable::convert(const BasicRGB<double> &) const;
+template BasicLAB<float> LabTable::convert(const BasicRGB<float> &) const;
+template void LabTable::convert(const unsigned char *, std::size_t, double *, double *, double *) const;
+template void LabTable::convert(const unsigned char *, std::size_t, float *, float *, float *) const;
@@ -0,0 +1,53 @@
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+// built for AVX2 and FMA whatever flags the rest of the program gets,
+// lab_kernel() only picks it on CPUs that have it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC target("avx2,fma")
+#endif
+
+#include "color_space_batch.h"
+
+#include <immintrin.h>
+
+struct LabVecAvx2 {
+  using Reg = __m256d;
+  static const int width = 4;
+  static Reg set1(double a) { return _mm256_set1_pd(a); }
+  static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+  static Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+  static Reg floor(Reg a) { return _mm256_floor_pd(a); }
+  static Reg select_gt(Reg a, Reg b, Reg a_val, Reg b_val) {
+    return _mm256_blendv_pd(b_val, a_val, _mm256_cmp_pd(a, b, _CMP_GT_OQ));
+  }
+  static Reg gather(const double *table, const int32_t *index) {
+    return _mm256_i32gather_pd(table, _mm_loadu_si128((const __m128i *)index), 8);
+  }
+  static void store(double *p, Reg a) { _mm256_storeu_pd(p, a); }
+  static void store(float *p, Reg a) { _mm_storeu_ps(p, _mm256_cvtpd_ps(a)); }
+  static Reg exponent(Reg a) {
+    __m256i bits =
+        _mm256_or_si256(_mm256_srli_epi64(_mm256_castpd_si256(a), 52), _mm256_set1_epi64x(0x4330000000000000));
+    return _mm256_sub_pd(_mm256_castsi256_pd(bits), _mm256_set1_pd(0x1p52));
+  }
+  static Reg mantissa(Reg a) {
+    __m256i bits = _mm256_and_si256(_mm256_castpd_si256(a), _mm256_set1_epi64x(0x000FFFFFFFFFFFFF));
+    return _mm256_castsi256_pd(_mm256_or_si256(bits, _mm256_set1_epi64x(0x3FF0000000000000)));
+  }
+  static Reg pow2(Reg a) {
+    return _mm256_castsi256_pd(
+        _mm256_slli_epi64(_mm256_castpd_si256(_mm256_add_pd(a, _mm256_set1_pd(0x1p52 + 1023))), 52));
+  }
+};
+
+DEFINE_LAB_KERNELS(avx2, LabVecAvx2)
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+// built for AVX-512F and BW whatever flags the rest of the program gets,
+// lab_kernel() only picks it on CPUs that have it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,avx512bw"))), apply_to = function)
+#else
+#pragma GCC target("avx512f,avx512bw")
+#endif
+
+#include "color_space_batch.h"
+
+#include <immintrin.h>
+
+struct LabVecAvx512 {
+  using Reg = __m512d;
+  static const int width = 8;
+  static Reg set1(double a) { return _mm512_set1_pd(a); }
+  static Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+  static Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+  static Reg floor(Reg a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+  static Reg select_gt(Reg a, Reg b, Reg a_val, Reg b_val) {
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(a, b, _CMP_GT_OQ), b_val, a_val);
+  }
+  static Reg gather(const double *table, const int32_t *index) {
+    return _mm512_i32gather_pd(_mm256_loadu_si256((const __m256i *)index), table, 8);
+  }
+  static void store(double *p, Reg a) { _mm512_storeu_pd(p, a); }
+  static void store(float *p, Reg a) { _mm256_storeu_ps(p, _mm512_cvtpd_ps(a)); }
+  static Reg exponent(Reg a) {
+    __m512i bits =
+        _mm512_or_si512(_mm512_srli_epi64(_mm512_castpd_si512(a), 52), _mm512_set1_epi64(0x4330000000000000));
+    return _mm512_sub_pd(_mm512_castsi512_pd(bits), _mm512_set1_pd(0x1p52));
+  }
+  static Reg mantissa(Reg a) {
+    __m512i bits = _mm512_and_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(0x000FFFFFFFFFFFFF));
+    return _mm512_castsi512_pd(_mm512_or_si512(bits, _mm512_set1_epi64(0x3FF0000000000000)));
+  }
+  static Reg pow2(Reg a) {
+    return _mm512_castsi512_pd(
+        _mm512_slli_epi64(_mm512_castpd_si512(_mm512_add_pd(a, _mm512_set1_pd(0x1p52 + 1023))), 52));
+  }
+};
+
+DEFINE_LAB_KERNELS(avx512, LabVecAvx512)
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
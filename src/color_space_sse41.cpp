@@ -0,0 +1,51 @@
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+// built for SSE4.1 whatever flags the rest of the program gets,
+// lab_kernel() only picks it on CPUs that have it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#else
+#pragma GCC target("sse4.1")
+#endif
+
+#include "color_space_batch.h"
+
+#include <smmintrin.h>
+
+struct LabVecSse41 {
+  using Reg = __m128d;
+  static const int width = 2;
+  static Reg set1(double a) { return _mm_set1_pd(a); }
+  static Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+  static Reg div(Reg a, Reg b) { return _mm_div_pd(a, b); }
+  static Reg floor(Reg a) { return _mm_floor_pd(a); }
+  // lanes where a > b take `a_val`, the others `b_val`
+  static Reg select_gt(Reg a, Reg b, Reg a_val, Reg b_val) { return _mm_blendv_pd(b_val, a_val, _mm_cmpgt_pd(a, b)); }
+  static Reg gather(const double *table, const int32_t *index) { return _mm_set_pd(table[index[1]], table[index[0]]); }
+  static void store(double *p, Reg a) { _mm_storeu_pd(p, a); }
+  static void store(float *p, Reg a) { _mm_storel_pi((__m64 *)p, _mm_cvtpd_ps(a)); }
+  // biased exponent of positive lanes, as a double
+  static Reg exponent(Reg a) {
+    __m128i bits = _mm_or_si128(_mm_srli_epi64(_mm_castpd_si128(a), 52), _mm_set1_epi64x(0x4330000000000000));
+    return _mm_sub_pd(_mm_castsi128_pd(bits), _mm_set1_pd(0x1p52));
+  }
+  // significand in [1, 2)
+  static Reg mantissa(Reg a) {
+    __m128i bits = _mm_and_si128(_mm_castpd_si128(a), _mm_set1_epi64x(0x000FFFFFFFFFFFFF));
+    return _mm_castsi128_pd(_mm_or_si128(bits, _mm_set1_epi64x(0x3FF0000000000000)));
+  }
+  // 2^a for whole a in [-1022, 1023]
+  static Reg pow2(Reg a) {
+    return _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(_mm_add_pd(a, _mm_set1_pd(0x1p52 + 1023))), 52));
+  }
+};
+
+DEFINE_LAB_KERNELS(sse41, LabVecSse41)
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+#include "curve.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// bits per coordinate are capped here: 1024 cells span the Lab range in steps well below one unit, and finer cells
+// would not bring similar colors any closer in memory but would cost more radix passes
+const int CURVE_MAX_BITS = 10;
+
+// bits of the key sorted on per radix pass
+const int RADIX_BITS = 11;
+
+// Interleave the coordinate bits, most significant first, with the first coordinate in the highest position.
+template <int Dim> uint64_t interleave(const uint32_t *x, int bits) {
+  uint64_t key = 0;
+  for (int bit = bits - 1; bit >= 0; bit--) {
+    for (int d = 0; d < Dim; d++) {
+      key = (key << 1) | ((x[d] >> bit) & 1);
+    }
+  }
+  return key;
+}
+
+// Hilbert index of a cell in Skilling's transposed form ("Programming the Hilbert curve", 2004): the coordinates are
+// rotated and reflected in place, after which interleaving their bits gives the distance along the curve.
+template <int Dim> uint64_t hilbert_key(uint32_t *x, int bits) {
+  uint32_t top = (uint32_t)1 << (bits - 1);
+  for (uint32_t q = top; q > 1; q >>= 1) {
+    uint32_t p = q - 1;
+    // invert the low bits of x[0] where bit q of x[d] is set, exchange them with x[d] otherwise; written without a
+    // branch, as the bit is unpredictable
+    for (int d = 0; d < Dim; d++) {
+      uint32_t set = (x[d] & q) ? ~0u : 0;
+      uint32_t t = (x[0] ^ x[d]) & p & ~set;
+      x[0] ^= (p & set) | t;
+      x[d] ^= t;
+    }
+  }
+
+  // Gray encode
+  for (int d = 1; d < Dim; d++) {
+    x[d] ^= x[d - 1];
+  }
+  uint32_t t = 0;
+  for (uint32_t q = top; q > 1; q >>= 1) {
+    if (x[Dim - 1] & q) {
+      t ^= q - 1;
+    }
+  }
+  for (int d = 0; d < Dim; d++) {
+    x[d] ^= t;
+  }
+
+  return interleave<Dim>(x, bits);
+}
+
+template <int Dim, typename Scalar>
+std::vector<uint32_t> curve_order(const Scalar *const *channels, std::size_t n, Curve curve) {
+  std::vector<uint32_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  if (curve == Curve::none || n < 2) {
+    return order;
+  }
+
+  int bits = std::min(CURVE_MAX_BITS, 64 / Dim);
+  double cells = (double)(((uint32_t)1 << bits) - 1);
+  double low[Dim];
+  double scale[Dim];
+  for (int d = 0; d < Dim; d++) {
+    auto range = std::minmax_element(channels[d], channels[d] + n);
+    low[d] = *range.first;
+    scale[d] = *range.second > *range.first ? cells / ((double)*range.second - low[d]) : 0;
+  }
+
+  std::vector<uint64_t> keys(n);
+  for (std::size_t j = 0; j < n; j++) {
+    uint32_t x[Dim];
+    for (int d = 0; d < Dim; d++) {
+      x[d] = (uint32_t)(((double)channels[d][j] - low[d]) * scale[d] + 0.5);
+    }
+    keys[j] = curve == Curve::hilbert ? hilbert_key<Dim>(x, bits) : interleave<Dim>(x, bits);
+  }
+
+  // LSD radix sort, each pass is stable so equal keys keep their order
+  std::vector<uint64_t> next_keys(n);
+  std::vector<uint32_t> next_order(n);
+  std::vector<std::size_t> offsets((std::size_t)1 << RADIX_BITS);
+  uint64_t mask = offsets.size() - 1;
+  for (int shift = 0; shift < Dim * bits; shift += RADIX_BITS) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (uint64_t key : keys) {
+      offsets[(key >> shift) & mask]++;
+    }
+    std::size_t total = 0;
+    for (std::size_t &offset : offsets) {
+      std::size_t count = offset;
+      offset = total;
+      total += count;
+    }
+    for (std::size_t j = 0; j < n; j++) {
+      std::size_t to = offsets[(keys[j] >> shift) & mask]++;
+      next_keys[to] = keys[j];
+      next_order[to] = order[j];
+    }
+    keys.swap(next_keys);
+    order.swap(next_order);
+  }
+  return order;
+}
+
+template std::vector<uint32_t> curve_order<1, double>(const double *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<2, double>(const double *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<3, double>(const double *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<4, double>(const double *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<1, float>(const float *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<2, float>(const float *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<3, float>(const float *const *, std::size_t, Curve);
+template std::vector<uint32_t> curve_order<4, float>(const float *const *, std::size_t, Curve);
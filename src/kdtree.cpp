@@ -0,0 +1,243 @@
+#include "kdtree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+const std::size_t LEAF_SIZE = 16;
+
+// depth at which the tree is cut into independently filtered subtrees, giving up to 2^TASK_DEPTH tasks
+const int TASK_DEPTH = 6;
+
+const uint32_t MIXED = std::numeric_limits<uint32_t>::max();
+
+template <int Dim, typename Scalar>
+KdTree<Dim, Scalar>::KdTree(const Scalar *const *channels, const uint32_t *weights, std::size_t n, uint32_t label)
+    : order(n), max_depth(0) {
+  std::iota(order.begin(), order.end(), 0);
+  build(channels, weights, 0, n, 0);
+
+  for (int d = 0; d < Dim; d++) {
+    this->channels[d].resize(n);
+    for (std::size_t p = 0; p < n; p++) {
+      this->channels[d][p] = channels[d][order[p]];
+    }
+  }
+  this->weights.resize(n);
+  for (std::size_t p = 0; p < n; p++) {
+    this->weights[p] = weights[order[p]];
+  }
+  for (Node &node : nodes) {
+    node.label = label;
+  }
+}
+
+template <int Dim, typename Scalar>
+int KdTree<Dim, Scalar>::build(const Scalar *const *channels, const uint32_t *weights, std::size_t begin,
+                               std::size_t end, int depth) {
+  int index = nodes.size();
+  max_depth = std::max(max_depth, depth);
+
+  Node node;
+  node.begin = begin;
+  node.end = end;
+  node.left = -1;
+  node.right = -1;
+  node.weight = 0;
+  for (int d = 0; d < Dim; d++) {
+    node.lo[d] = std::numeric_limits<Scalar>::max();
+    node.hi[d] = std::numeric_limits<Scalar>::lowest();
+    node.sum[d] = 0;
+    node.sum_sq[d] = 0;
+  }
+  for (std::size_t p = begin; p < end; p++) {
+    uint32_t j = order[p];
+    for (int d = 0; d < Dim; d++) {
+      node.lo[d] = std::min(node.lo[d], channels[d][j]);
+      node.hi[d] = std::max(node.hi[d], channels[d][j]);
+      node.sum[d] += (double)weights[j] * channels[d][j];
+      node.sum_sq[d] += (double)weights[j] * channels[d][j] * channels[d][j];
+    }
+    node.weight += weights[j];
+  }
+  nodes.push_back(node);
+
+  int split = 0;
+  for (int d = 1; d < Dim; d++) {
+    if (node.hi[d] - node.lo[d] > node.hi[split] - node.lo[split]) {
+      split = d;
+    }
+  }
+
+  if (end - begin <= LEAF_SIZE || node.hi[split] == node.lo[split]) {
+    if (depth <= TASK_DEPTH) {
+      roots.push_back(index);
+    }
+    return index;
+  }
+  if (depth == TASK_DEPTH) {
+    roots.push_back(index);
+  }
+
+  std::size_t mid = begin + (end - begin) / 2;
+  const Scalar *channel = channels[split];
+  std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                   [channel](uint32_t a, uint32_t b) { return channel[a] < channel[b]; });
+
+  int left = build(channels, weights, begin, mid, depth + 1);
+  int right = build(channels, weights, mid, end, depth + 1);
+  nodes[index].left = left;
+  nodes[index].right = right;
+  return index;
+}
+
+template <int Dim, typename Scalar> std::size_t KdTree<Dim, Scalar>::tasks() const { return roots.size(); }
+
+template <int Dim, typename Scalar>
+std::size_t KdTree<Dim, Scalar>::assign(std::size_t task, const Scalar *centroids, int k, uint32_t *labels,
+                                        double *sums, double *sums_sq, std::size_t *counts,
+                                        std::size_t &distances) {
+  // room for one candidate list per tree level below the task root
+  std::vector<uint32_t> scratch((std::size_t)k * (max_depth + 2));
+  std::iota(scratch.begin(), scratch.begin() + k, 0);
+  return filter(roots[task], scratch.data(), k, scratch.data() + k, centroids, k, labels, sums, sums_sq, counts,
+                distances);
+}
+
+template <int Dim, typename Scalar>
+std::size_t KdTree<Dim, Scalar>::filter(int index, const uint32_t *candidates, int count, uint32_t *scratch,
+                                        const Scalar *centroids, int k, uint32_t *labels, double *sums,
+                                        double *sums_sq, std::size_t *counts, std::size_t &distances) {
+  Node &node = nodes[index];
+
+  if (count > 1) {
+    // the candidate closest to the middle of the cell survives, others go if it is closer to the whole cell
+    uint32_t closest = candidates[0];
+    double closest_dist2 = std::numeric_limits<double>::infinity();
+    for (int c = 0; c < count; c++) {
+      const Scalar *z = &centroids[candidates[c] * Dim];
+      double dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        double diff = ((double)node.lo[d] + node.hi[d]) / 2 - z[d];
+        dist2 += diff * diff;
+      }
+      if (dist2 < closest_dist2) {
+        closest_dist2 = dist2;
+        closest = candidates[c];
+      }
+    }
+
+    const Scalar *best = &centroids[closest * Dim];
+    int kept = 0;
+    for (int c = 0; c < count; c++) {
+      if (candidates[c] == closest) {
+        scratch[kept++] = closest;
+        continue;
+      }
+      // compare both centroids at the cell corner furthest in the direction from `best` to `z`
+      const Scalar *z = &centroids[candidates[c] * Dim];
+      double z_dist2 = 0;
+      double best_dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        double corner = z[d] > best[d] ? node.hi[d] : node.lo[d];
+        z_dist2 += (z[d] - corner) * (z[d] - corner);
+        best_dist2 += (best[d] - corner) * (best[d] - corner);
+      }
+      if (!(z_dist2 > best_dist2)) {
+        scratch[kept++] = candidates[c];
+      }
+    }
+    distances += 2 * count - 1;
+
+    candidates = scratch;
+    count = kept;
+    scratch += k;
+  }
+
+  if (count == 1) {
+    uint32_t label = candidates[0];
+    for (int d = 0; d < Dim; d++) {
+      sums[label * Dim + d] += node.sum[d];
+      sums_sq[label * Dim + d] += node.sum_sq[d];
+    }
+    counts[label] += node.weight;
+    return relabel(index, label, labels);
+  }
+
+  if (node.left >= 0) {
+    std::size_t moved =
+        filter(node.left, candidates, count, scratch, centroids, k, labels, sums, sums_sq, counts, distances);
+    moved += filter(node.right, candidates, count, scratch, centroids, k, labels, sums, sums_sq, counts, distances);
+    uint32_t left = nodes[node.left].label;
+    node.label = left == nodes[node.right].label ? left : MIXED;
+    return moved;
+  }
+
+  std::size_t moved = 0;
+  uint32_t shared = MIXED;
+  for (std::size_t p = node.begin; p < node.end; p++) {
+    Scalar min_dist = std::numeric_limits<Scalar>::infinity();
+    uint32_t min_i = 0;
+    for (int c = 0; c < count; c++) {
+      Scalar dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        Scalar diff = channels[d][p] - centroids[candidates[c] * Dim + d];
+        dist2 += diff * diff;
+      }
+      if (dist2 < min_dist) {
+        min_dist = dist2;
+        min_i = candidates[c];
+      }
+    }
+
+    for (int d = 0; d < Dim; d++) {
+      sums[min_i * Dim + d] += (double)weights[p] * channels[d][p];
+      sums_sq[min_i * Dim + d] += (double)weights[p] * channels[d][p] * channels[d][p];
+    }
+    counts[min_i] += weights[p];
+
+    uint32_t &label = labels[order[p]];
+    if (label != min_i) {
+      label = min_i;
+      moved++;
+    }
+    shared = p == node.begin || shared == min_i ? min_i : MIXED;
+  }
+  distances += (node.end - node.begin) * count;
+  node.label = shared;
+  return moved;
+}
+
+template <int Dim, typename Scalar>
+std::size_t KdTree<Dim, Scalar>::relabel(int index, uint32_t label, uint32_t *labels) {
+  Node &node = nodes[index];
+  if (node.label == label) {
+    return 0;
+  }
+
+  std::size_t moved = 0;
+  if (node.left >= 0) {
+    moved = relabel(node.left, label, labels) + relabel(node.right, label, labels);
+  } else {
+    for (std::size_t p = node.begin; p < node.end; p++) {
+      if (labels[order[p]] != label) {
+        labels[order[p]] = label;
+        moved++;
+      }
+    }
+  }
+  node.label = label;
+  return moved;
+}
+
+template class KdTree<1, double>;
+template class KdTree<2, double>;
+template class KdTree<3, double>;
+template class KdTree<4, double>;
+template class KdTree<1, float>;
+template class KdTree<2, float>;
+template class KdTree<3, float>;
+template class KdTree<4, float>;
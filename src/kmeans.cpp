@@ -1,122 +1,956 @@
 #include "kmeans.h"
+#include "curve.h"
+#include "kmeans_bounds.h"
+#include "kmeans_fixed.h"
+#include "kmeans_kernel.h"
+#include "kmeans_seeding.h"
+#include "kdtree.h"
 #include "myrand.h"
+#include "parallel.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
-#include <unordered_set>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
 #include <utility>
 #include <vector>
 
-KMeans::KMeans(const std::vector<Point> &points, int dim) : points(points) { this->dim = dim; }
+// below this many clusters the bounds engine uses Hamerly's single lower bound instead of Elkan's k bounds
+const int ELKAN_MIN_K = 32;
 
-std::vector<Cluster> KMeans::cluster(int k) {
+// mini-batch stops once no centroid moves more than MINIBATCH_TOL (Lab units) for MINIBATCH_PATIENCE batches in a row,
+// unless a tolerance is given
+const double MINIBATCH_TOL = 0.01;
+const int MINIBATCH_PATIENCE = 10;
+const int MINIBATCH_MAX_BATCHES = 1000;
+
+// restarts all run RESTART_GRACE iterations, then those whose inertia is more than RESTART_SLACK above the best so
+// far are dropped
+const int RESTART_GRACE = 5;
+const double RESTART_SLACK = 0.25;
+
+// number of earlier assignments remembered to detect label cycles
+const std::size_t CYCLE_HISTORY = 16;
+
+// a chunk whose moved points exceed 1 / INCREMENTAL_MAX_MOVED of its size rebuilds its sums instead of patching them,
+// which is cheaper at that point and also discards rounding drift from earlier patches
+const std::size_t INCREMENTAL_MAX_MOVED = 8;
+
+// empty cluster repair ignores spreads and distances below this (squared Lab units), they are rounding noise
+const double REPAIR_MIN_DIST2 = 1e-6;
+
+// FNV-1a over the label array
+uint64_t label_hash(const std::vector<uint32_t> &labels) {
+  uint64_t hash = 14695981039346656037ull;
+  for (uint32_t label : labels) {
+    hash = (hash ^ label) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Bring the sums of points [begin, end) in line with `labels`, `moved` of which changed since `summed`: the points that
+// moved are patched in when they are few, otherwise the k clusters' sums are rebuilt. `at(d, j)` is coordinate d of
+// point j as it is summed, a plain or a quantized value.
+template <int Dim, typename Sum, typename At>
+void update_sums(std::size_t begin, std::size_t end, std::size_t moved, int k, const uint32_t *weights,
+                 const uint32_t *labels, uint32_t *summed, Sum *sums, double *sums_sq, std::size_t *counts, At at) {
+  if (moved * INCREMENTAL_MAX_MOVED <= end - begin) {
+    for (std::size_t j = begin; j < end; j++) {
+      uint32_t from = summed[j];
+      uint32_t to = labels[j];
+      if (from == to) {
+        continue;
+      }
+      for (int d = 0; d < Dim; d++) {
+        Sum value = (Sum)weights[j] * at(d, j);
+        sums[from * Dim + d] -= value;
+        sums_sq[from * Dim + d] -= (double)value * at(d, j);
+        sums[to * Dim + d] += value;
+        sums_sq[to * Dim + d] += (double)value * at(d, j);
+      }
+      counts[from] -= weights[j];
+      counts[to] += weights[j];
+      summed[j] = to;
+    }
+    return;
+  }
+
+  std::fill(sums, sums + k * Dim, 0);
+  std::fill(sums_sq, sums_sq + k * Dim, 0);
+  std::fill(counts, counts + k, 0);
+  for (int d = 0; d < Dim; d++) {
+    for (std::size_t j = begin; j < end; j++) {
+      Sum value = (Sum)weights[j] * at(d, j);
+      sums[labels[j] * Dim + d] += value;
+      sums_sq[labels[j] * Dim + d] += (double)value * at(d, j);
+    }
+  }
+  for (std::size_t j = begin; j < end; j++) {
+    counts[labels[j]] += weights[j];
+  }
+  std::copy(labels + begin, labels + end, summed + begin);
+}
+
+template <int Dim, typename Scalar> BasicKMeans<Dim, Scalar>::BasicKMeans() {}
+
+template <int Dim, typename Scalar> BasicKMeans<Dim, Scalar>::BasicKMeans(const std::vector<Point> &points) {
+  reserve(points.size());
+  for (const Point &point : points) {
+    for (int d = 0; d < Dim; d++) {
+      channels[d].push_back(point[d]);
+    }
+    weights.push_back(1);
+  }
+}
+
+template <int Dim, typename Scalar> void BasicKMeans<Dim, Scalar>::reserve(std::size_t n) {
+  for (auto &channel : channels) {
+    channel.reserve(n);
+  }
+  weights.reserve(n);
+}
+
+template <int Dim, typename Scalar> void BasicKMeans<Dim, Scalar>::push_back(const Sample &sample, uint32_t weight) {
+  for (int d = 0; d < Dim; d++) {
+    channels[d].push_back(sample[d]);
+  }
+  weights.push_back(weight);
+}
+
+template <int Dim, typename Scalar> std::size_t BasicKMeans<Dim, Scalar>::size() const { return channels[0].size(); }
+
+template <int Dim, typename Scalar> const Scalar *BasicKMeans<Dim, Scalar>::channel(int d) const {
+  return channels[d].data();
+}
+
+template <int Dim, typename Scalar> const uint32_t *BasicKMeans<Dim, Scalar>::get_weights() const {
+  return weights.data();
+}
+
+template <int Dim, typename Scalar> void BasicKMeans<Dim, Scalar>::sort(Curve curve) {
+  if (curve == Curve::none) {
+    return;
+  }
+
+  const Scalar *ch[Dim];
+  for (int d = 0; d < Dim; d++) {
+    ch[d] = channels[d].data();
+  }
+  std::vector<uint32_t> order = curve_order<Dim, Scalar>(ch, size(), curve);
+
+  for (auto &channel : channels) {
+    std::vector<Scalar> sorted(order.size());
+    for (std::size_t j = 0; j < order.size(); j++) {
+      sorted[j] = channel[order[j]];
+    }
+    channel = std::move(sorted);
+  }
+  std::vector<uint32_t> sorted(order.size());
+  for (std::size_t j = 0; j < order.size(); j++) {
+    sorted[j] = weights[order[j]];
+  }
+  weights = std::move(sorted);
+  labels.clear();
+}
+
+template <int Dim, typename Scalar>
+std::vector<typename BasicKMeans<Dim, Scalar>::Cluster> BasicKMeans<Dim, Scalar>::cluster(int k) {
   MyRand rng;
   return cluster(k, rng);
 }
 
-std::vector<Cluster> KMeans::cluster(int k, MyRand &rng) {
-  std::vector<std::pair<double, double>> limits;
-  limits.resize(dim);
-  std::fill(
-      limits.begin(), limits.end(),
-      std::pair<double, double>{std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()});
+template <int Dim, typename Scalar>
+std::vector<typename BasicKMeans<Dim, Scalar>::Cluster> BasicKMeans<Dim, Scalar>::cluster(int k, MyRand &rng,
+                                                                                          bool members) {
+  std::vector<Cluster> clusters;
+  if (options.engine == Engine::bisecting) {
+    clusters = bisect(k, rng).back();
+  } else if (options.restarts > 1) {
+    clusters = restart(k, rng);
+  } else {
+    clusters = run(k, rng, nullptr, options.max_iter, thread_count(options.threads), labels, stats);
+  }
+
+  if (members) {
+    fill_members(clusters);
+  }
+
+  return clusters;
+}
+
+template <int Dim, typename Scalar>
+std::vector<typename BasicKMeans<Dim, Scalar>::Cluster>
+BasicKMeans<Dim, Scalar>::cluster(int k, const std::vector<Sample> &initial, MyRand &rng, bool members) {
+  if (initial.empty()) {
+    throw std::runtime_error("error: no initial centroids");
+  }
 
-  for (int i = 0; i < dim; i++) {
-    for (auto &point : this->points) {
-      if (point[i] < limits[i].first) {
-        limits[i].first = point[i];
+  std::vector<Sample> seeds(initial.begin(), initial.begin() + std::min((std::size_t)k, initial.size()));
+  std::vector<Cluster> clusters = run(k, rng, &seeds, options.max_iter, thread_count(options.threads), labels, stats);
+
+  if (members) {
+    fill_members(clusters);
+  }
+
+  return clusters;
+}
+
+template <int Dim, typename Scalar> void BasicKMeans<Dim, Scalar>::fill_members(std::vector<Cluster> &clusters) const {
+  for (Cluster &cluster : clusters) {
+    cluster.members.reserve(cluster.count);
+  }
+  for (std::size_t j = 0; j < labels.size(); j++) {
+    clusters[labels[j]].members.push_back(j);
+  }
+}
+
+template <int Dim, typename Scalar>
+std::vector<std::vector<typename BasicKMeans<Dim, Scalar>::Cluster>>
+BasicKMeans<Dim, Scalar>::bisect(int max_k, MyRand &rng, std::vector<double> *inertia) {
+  std::size_t n = size();
+  stats = KMeansStats();
+  labels.assign(n, 0);
+
+  std::vector<std::vector<uint32_t>> members(1, std::vector<uint32_t>(n));
+  std::iota(members[0].begin(), members[0].end(), 0);
+  std::vector<Cluster> clusters(1);
+  std::vector<double> error = {squared_error(members[0], clusters[0])};
+
+  // each half is split by a plain 2-means run over the members of the cluster
+  KMeansOptions split_options = options;
+  split_options.engine = Engine::lloyd;
+
+  std::vector<std::vector<Cluster>> levels = {clusters};
+  stats.inertia = error[0];
+  if (inertia) {
+    *inertia = {stats.inertia};
+  }
+  while ((int)clusters.size() < max_k) {
+    int worst = -1;
+    for (int i = 0; i < (int)clusters.size(); i++) {
+      if (members[i].size() >= 2 && error[i] > REPAIR_MIN_DIST2 && (worst < 0 || error[i] > error[worst])) {
+        worst = i;
       }
-      if (point[i] > limits[i].second) {
-        limits[i].second = point[i];
+    }
+    if (worst < 0) {
+      break;
+    }
+
+    BasicKMeans half;
+    half.reserve(members[worst].size());
+    for (uint32_t j : members[worst]) {
+      Sample sample;
+      for (int d = 0; d < Dim; d++) {
+        sample[d] = channels[d][j];
       }
+      half.push_back(sample, weights[j]);
+    }
+    half.set_options(split_options);
+    half.cluster(2, rng);
+
+    const KMeansStats &split_stats = half.get_stats();
+    stats.iterations += split_stats.iterations;
+    stats.distances += split_stats.distances;
+    stats.skipped += split_stats.skipped;
+    if (split_stats.termination != Termination::converged) {
+      stats.termination = split_stats.termination;
+    }
+
+    std::vector<uint32_t> kept;
+    std::vector<uint32_t> moved;
+    const std::vector<uint32_t> &split_labels = half.get_labels();
+    for (std::size_t m = 0; m < split_labels.size(); m++) {
+      (split_labels[m] ? moved : kept).push_back(members[worst][m]);
+    }
+    if (kept.empty() || moved.empty()) {
+      // 2-means found no second cluster here, leave this one alone from now on
+      error[worst] = 0;
+      continue;
+    }
+
+    uint32_t label = clusters.size();
+    for (uint32_t j : moved) {
+      labels[j] = label;
+    }
+    clusters.emplace_back();
+    stats.inertia -= error[worst];
+    error.push_back(squared_error(moved, clusters.back()));
+    error[worst] = squared_error(kept, clusters[worst]);
+    stats.inertia += error[worst] + error.back();
+    members[worst] = std::move(kept);
+    members.push_back(std::move(moved));
+    levels.push_back(clusters);
+    if (inertia) {
+      inertia->push_back(stats.inertia);
     }
   }
 
-  std::vector<Cluster> clusters;
+  return levels;
+}
 
-  {
-    std::unordered_set<const Point *> centroids;
-    std::vector<double> dists;
-    dists.resize(points.size());
-    std::fill(dists.begin(), dists.end(), 0);
+template <int Dim, typename Scalar>
+std::vector<std::vector<typename BasicKMeans<Dim, Scalar>::Cluster>>
+BasicKMeans<Dim, Scalar>::cluster_each(const std::vector<int> &ks, MyRand &rng, std::vector<KMeansStats> &stats) {
+  std::vector<std::vector<Cluster>> results(ks.size());
+  stats.assign(ks.size(), KMeansStats());
+  if (ks.empty()) {
+    return results;
+  }
 
-    const Point *last_centroid = &points[rng.randint(0, points.size())];
-    centroids.insert(last_centroid);
+  if (options.engine == Engine::bisecting) {
+    std::vector<uint32_t> kept_labels = labels;
+    KMeansStats kept_stats = this->stats;
+    std::vector<double> inertia;
+    auto levels = bisect(*std::max_element(ks.begin(), ks.end()), rng, &inertia);
+    for (std::size_t i = 0; i < ks.size(); i++) {
+      std::size_t level = std::min<std::size_t>(ks[i], levels.size()) - 1;
+      results[i] = levels[level];
+      stats[i] = this->stats;
+      stats[i].inertia = inertia[level];
+    }
+    labels = std::move(kept_labels);
+    this->stats = kept_stats;
+    return results;
+  }
 
-    for (int i = 1; i < k; i++) {
-      double maxDist = 0;
-      int maxJ = -1;
+  int threads = thread_count(options.threads);
+  int inner_threads = std::max(threads / (int)ks.size(), 1);
 
-      for (int j = 0; j < points.size(); j++) {
-        dists[j] += dist_sq(*last_centroid, points[j]);
-        if (dists[j] > maxDist && centroids.find(&points[j]) == centroids.end()) {
-          maxDist = dists[j];
-          maxJ = j;
-        }
-      }
+  // as for restarts, every run has its own stream so results do not depend on scheduling
+  unsigned int base = rng.randint(0, std::numeric_limits<int>::max());
+  parallel_for(threads, ks.size(), [&](std::size_t i) {
+    MyRand run_rng(base + (unsigned int)i);
+    std::vector<uint32_t> run_labels;
+    results[i] = run(ks[i], run_rng, nullptr, options.max_iter, inner_threads, run_labels, stats[i]);
+  });
+  return results;
+}
+
+// weighted centroid and count of the given points, returning their squared error around it
+template <int Dim, typename Scalar>
+double BasicKMeans<Dim, Scalar>::squared_error(const std::vector<uint32_t> &points, Cluster &cluster) const {
+  double sums[Dim] = {0};
+  cluster.count = 0;
+  for (uint32_t j : points) {
+    for (int d = 0; d < Dim; d++) {
+      sums[d] += (double)weights[j] * channels[d][j];
+    }
+    cluster.count += weights[j];
+  }
+  for (int d = 0; d < Dim; d++) {
+    cluster.centroid[d] = cluster.count ? sums[d] / cluster.count : 0;
+  }
 
-      if (maxJ != -1) {
-        last_centroid = &points[maxJ];
-        centroids.insert(last_centroid);
+  double error = 0;
+  for (uint32_t j : points) {
+    for (int d = 0; d < Dim; d++) {
+      double diff = (double)channels[d][j] - cluster.centroid[d];
+      error += weights[j] * diff * diff;
+    }
+  }
+  return error;
+}
+
+template <int Dim, typename Scalar>
+std::vector<typename BasicKMeans<Dim, Scalar>::Cluster> BasicKMeans<Dim, Scalar>::restart(int k, MyRand &rng) {
+  int restarts = options.restarts;
+  int threads = thread_count(options.threads);
+  // restarts run side by side, any threads left over go to the runs themselves
+  int inner_threads = std::max(threads / restarts, 1);
+
+  // each restart has its own stream derived from the caller's, so results do not depend on scheduling
+  unsigned int base = rng.randint(0, std::numeric_limits<int>::max());
+  std::vector<MyRand> rngs;
+  for (int r = 0; r < restarts; r++) {
+    rngs.emplace_back(base + (unsigned int)r);
+  }
+
+  std::vector<std::vector<Cluster>> results(restarts);
+  std::vector<std::vector<uint32_t>> restart_labels(restarts);
+  std::vector<KMeansStats> restart_stats(restarts);
+
+  // first every restart gets a short head start
+  int grace = options.max_iter > 0 ? std::min(RESTART_GRACE, options.max_iter) : RESTART_GRACE;
+  parallel_for(threads, restarts, [&](std::size_t r) {
+    results[r] = run(k, rngs[r], nullptr, grace, inner_threads, restart_labels[r], restart_stats[r]);
+  });
+
+  double best = std::numeric_limits<double>::infinity();
+  for (const KMeansStats &s : restart_stats) {
+    best = std::min(best, s.inertia);
+  }
+
+  // then only the ones that are not clearly behind carry on from where they stopped
+  bool resume = options.max_iter <= 0 || options.max_iter > grace;
+  std::vector<bool> dropped(restarts, false);
+  std::vector<int> survivors;
+  for (int r = 0; r < restarts; r++) {
+    if (resume && restart_stats[r].termination == Termination::max_iter) {
+      if (restart_stats[r].inertia > best * (1 + RESTART_SLACK)) {
+        dropped[r] = true;
+      } else {
+        survivors.push_back(r);
       }
     }
+  }
 
-    for (const Point *centroid : centroids) {
-      clusters.push_back(Cluster{*centroid, {}});
+  int remaining = options.max_iter > 0 ? options.max_iter - grace : 0;
+  parallel_for(threads, survivors.size(), [&](std::size_t s) {
+    int r = survivors[s];
+    std::vector<Sample> centroids;
+    for (const Cluster &cluster : results[r]) {
+      centroids.push_back(cluster.centroid);
     }
+    KMeansStats head_start = restart_stats[r];
+    results[r] = run(k, rngs[r], &centroids, remaining, inner_threads, restart_labels[r], restart_stats[r]);
+    restart_stats[r].iterations += head_start.iterations;
+    restart_stats[r].distances += head_start.distances;
+    restart_stats[r].skipped += head_start.skipped;
+  });
+
+  // lowest inertia wins, ties go to the earliest restart
+  int winner = -1;
+  for (int r = 0; r < restarts; r++) {
+    if (!dropped[r] && (winner < 0 || restart_stats[r].inertia < restart_stats[winner].inertia)) {
+      winner = r;
+    }
+  }
+
+  stats = restart_stats[winner];
+  stats.abandoned = std::count(dropped.begin(), dropped.end(), true);
+  labels = std::move(restart_labels[winner]);
+  return std::move(results[winner]);
+}
+
+template <int Dim, typename Scalar>
+std::vector<typename BasicKMeans<Dim, Scalar>::Cluster>
+BasicKMeans<Dim, Scalar>::run(int k, MyRand &rng, const std::vector<Sample> *initial, int max_iter, int threads,
+                              std::vector<uint32_t> &labels, KMeansStats &stats) const {
+  std::size_t n = size();
+  std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+
+  const Scalar *ch[Dim];
+  for (int d = 0; d < Dim; d++) {
+    ch[d] = channels[d].data();
+  }
+
+  std::vector<Cluster> clusters;
+  std::vector<Sample> seeds;
+  if (initial) {
+    seeds = *initial;
+  } else {
+    switch (options.seeding) {
+    case Seeding::farthest:
+      seeds = seed_farthest<Dim, Scalar>(ch, weights.data(), n, k, rng, threads);
+      break;
+    case Seeding::kmeanspp:
+      seeds = seed_kmeanspp<Dim, Scalar>(ch, weights.data(), n, k, rng, threads);
+      break;
+    case Seeding::parallel:
+      seeds = seed_parallel<Dim, Scalar>(ch, weights.data(), n, k, rng, threads);
+      break;
+    }
+  }
+  for (const Sample &seed : seeds) {
+    clusters.push_back(Cluster{seed, 0, {}});
+  }
+
+  // fewer distinct seeds than requested, the remaining clusters start empty
+  while ((int)clusters.size() < k) {
+    clusters.push_back(Cluster{seeds[0], 0, {}});
+  }
+
+  // labels[j] == k marks a point that has not been assigned yet, so the first pass always counts as movement
+  labels.assign(n, k);
+  // labels as of the last update of the chunk sums, so only points that moved since need patching
+  std::vector<uint32_t> summed(n, k);
+  std::vector<double> sums(k * Dim);
+  std::vector<double> sums_sq(k * Dim);
+  std::vector<Scalar> centroids(k * Dim);
+
+  std::unique_ptr<DistanceBounds<Dim, Scalar>> bounds;
+  std::unique_ptr<KdTree<Dim, Scalar>> tree;
+  std::unique_ptr<FixedPoints<Dim, Scalar>> fixed;
+  std::vector<int16_t> fixed_centroids;
+  if (options.engine == Engine::kdtree) {
+    tree.reset(new KdTree<Dim, Scalar>(ch, weights.data(), n, k));
+  } else if (options.engine == Engine::fixed) {
+    fixed.reset(new FixedPoints<Dim, Scalar>(ch, n));
+    fixed_centroids.resize(k * Dim);
+  } else if (options.engine == Engine::hamerly || options.engine == Engine::elkan || options.engine == Engine::bounds) {
+    // minibatch makes a single full pass, where bounds would cost their upkeep without ever pruning a centroid
+    bool elkan = options.engine == Engine::elkan || (options.engine == Engine::bounds && k >= ELKAN_MIN_K);
+    bounds.reset(new DistanceBounds<Dim, Scalar>(n, k, elkan));
   }
 
-  bool flag = true;
-  std::vector<std::unordered_set<const Point *>> old_cluster_points;
-  old_cluster_points.resize(k);
+  // the kd-tree hands out its own fixed set of subtrees instead of point chunks
+  std::size_t tasks = tree ? tree->tasks() : chunks;
+  std::vector<double> partial_sums(tasks * k * Dim);
+  std::vector<double> partial_sums_sq(tasks * k * Dim);
+  std::vector<std::size_t> partial_counts(tasks * k);
+  std::vector<std::size_t> partial_moved(tasks);
+  std::vector<std::size_t> partial_distances(tasks);
+  // the fixed engine sums quantized coordinates exactly, sums and sums_sq are derived from these after each pass
+  std::vector<int64_t> partial_fixed_sums(fixed ? tasks * k * Dim : 0);
+  std::vector<int64_t> fixed_sums(fixed ? k * Dim : 0);
 
-  while (flag) {
+  stats = KMeansStats();
+  if (options.engine == Engine::minibatch) {
+    // the batches place the centroids, then a single full pass below labels every point
+    minibatch(clusters, rng, stats);
+  }
+
+  std::vector<Scalar> previous;
+  std::vector<uint64_t> history;
+  bool changed = true;
+  bool repaired = false;
+  while (changed) {
     for (int i = 0; i < k; i++) {
-      old_cluster_points[i] = std::move(clusters[i].points);
+      std::copy(clusters[i].centroid.begin(), clusters[i].centroid.end(), &centroids[i * Dim]);
     }
+    if (bounds) {
+      bounds->move_centroids(previous.empty() ? nullptr : previous.data(), centroids.data());
+      previous = centroids;
+    } else if (fixed) {
+      fixed->quantize(centroids.data(), k, fixed_centroids.data());
+    }
+
+    parallel_for(threads, tasks, [&](std::size_t c) {
+      double *sums = &partial_sums[c * k * Dim];
+      double *sums_sq = &partial_sums_sq[c * k * Dim];
+      std::size_t *counts = &partial_counts[c * k];
+      partial_distances[c] = 0;
+
+      if (tree) {
+        std::fill(sums, sums + k * Dim, 0);
+        std::fill(sums_sq, sums_sq + k * Dim, 0);
+        std::fill(counts, counts + k, 0);
+        partial_moved[c] =
+            tree->assign(c, centroids.data(), k, labels.data(), sums, sums_sq, counts, partial_distances[c]);
+        return;
+      }
+
+      std::size_t begin = c * CHUNK;
+      std::size_t end = std::min(begin + CHUNK, n);
+      if (bounds) {
+        partial_moved[c] = bounds->assign(ch, begin, end, centroids.data(), labels.data(), partial_distances[c]);
+      } else if (fixed) {
+        partial_distances[c] = (end - begin) * k;
+        partial_moved[c] =
+            assign_nearest_fixed<Dim>(fixed->data(), begin, end, fixed_centroids.data(), k, labels.data());
+      } else {
+        partial_distances[c] = (end - begin) * k;
+        partial_moved[c] = assign_nearest<Dim, Scalar>(ch, begin, end, centroids.data(), k, labels.data());
+      }
 
-    flag = false;
-    for (int j = 0; j < points.size(); j++) {
-      double min_dist = std::numeric_limits<double>::infinity();
-      int min_i = -1;
+      // the chunk sums persist across passes: untouched when no label changed, patched for the points that moved
+      if (!partial_moved[c]) {
+        return;
+      } else if (fixed) {
+        const int16_t *const *q = fixed->data();
+        update_sums<Dim>(begin, end, partial_moved[c], k, weights.data(), labels.data(), summed.data(),
+                         &partial_fixed_sums[c * k * Dim], sums_sq, counts,
+                         [q](int d, std::size_t j) { return (int64_t)q[d][j]; });
+      } else {
+        update_sums<Dim>(begin, end, partial_moved[c], k, weights.data(), labels.data(), summed.data(), sums, sums_sq,
+                         counts, [&ch](int d, std::size_t j) { return (double)ch[d][j]; });
+      }
+    });
+
+    std::size_t moved = 0;
+    std::fill(sums.begin(), sums.end(), 0);
+    std::fill(sums_sq.begin(), sums_sq.end(), 0);
+    std::fill(fixed_sums.begin(), fixed_sums.end(), 0);
+    for (Cluster &cluster : clusters) {
+      cluster.count = 0;
+    }
+    for (std::size_t c = 0; c < tasks; c++) {
+      moved += partial_moved[c];
+      stats.distances += partial_distances[c];
       for (int i = 0; i < k; i++) {
-        double dist = dist_sq(clusters[i].centroid, points[j]);
-        if (dist < min_dist) {
-          min_dist = dist;
-          min_i = i;
+        for (int d = 0; d < Dim; d++) {
+          sums[i * Dim + d] += partial_sums[(c * k + i) * Dim + d];
+          sums_sq[i * Dim + d] += partial_sums_sq[(c * k + i) * Dim + d];
         }
+        clusters[i].count += partial_counts[c * k + i];
+      }
+      for (std::size_t e = 0; e < fixed_sums.size(); e++) {
+        fixed_sums[e] += partial_fixed_sums[c * k * Dim + e];
+      }
+    }
+    if (fixed) {
+      for (int i = 0; i < k; i++) {
+        fixed->dequantize(&fixed_sums[i * Dim], clusters[i].count, &sums[i * Dim], &sums_sq[i * Dim]);
       }
-      if (min_i != -1) {
-        clusters[min_i].points.insert(&points[j]);
+    }
+
+    stats.iterations++;
+    if (options.engine == Engine::minibatch) {
+      break;
+    }
+
+    // an assignment seen before means the labels are going round in circles
+    bool cycle = false;
+    if (moved) {
+      uint64_t hash = label_hash(labels);
+      cycle = std::find(history.begin(), history.end(), hash) != history.end();
+      if (history.size() == CYCLE_HISTORY) {
+        history.erase(history.begin());
+      }
+      history.push_back(hash);
+    }
 
-        if (!flag && old_cluster_points[min_i].find(&points[j]) == old_cluster_points[min_i].end()) {
-          flag = true;
+    for (int i = 0; i < k; i++) {
+      if (clusters[i].count) {
+        for (int d = 0; d < Dim; d++) {
+          clusters[i].centroid[d] = sums[i * Dim + d] / clusters[i].count;
         }
       }
     }
+    // a repaired cluster has no points yet, so it needs at least one more pass; if the pass after a repair moved
+    // nothing, repairing again would only place the same centroids
+    repaired = (moved || !repaired) && repair(clusters, sums, sums_sq, centroids.data(), labels, threads);
+    changed = moved || repaired;
 
+    double max_shift = 0;
     for (int i = 0; i < k; i++) {
-      for (int d = 0; d < dim; d++) {
-        if (clusters[i].points.empty()) {
-          clusters[i].centroid[d] = rng.uniform(limits[d].first, limits[d].second);
-        } else {
-          double sum = 0;
-          for (const Point *point : clusters[i].points) {
-            sum += (*point)[d];
+      double shift2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        double diff = (double)clusters[i].centroid[d] - centroids[i * Dim + d];
+        shift2 += diff * diff;
+      }
+      max_shift = std::max(max_shift, std::sqrt(shift2));
+    }
+
+    if (changed && options.tol > 0 && max_shift <= options.tol) {
+      stats.termination = Termination::tolerance;
+      break;
+    } else if (changed && cycle) {
+      stats.termination = Termination::cycle;
+      break;
+    } else if (changed && max_iter > 0 && stats.iterations >= max_iter) {
+      stats.termination = Termination::max_iter;
+      break;
+    }
+  }
+
+  std::size_t lloyd_distances = (std::size_t)stats.iterations * n * k;
+  stats.skipped = lloyd_distances > stats.distances ? lloyd_distances - stats.distances : 0;
+
+  for (int i = 0; i < k; i++) {
+    std::copy(clusters[i].centroid.begin(), clusters[i].centroid.end(), &centroids[i * Dim]);
+  }
+  std::vector<double> partial_inertia(chunks);
+  parallel_for(threads, chunks, [&](std::size_t c) {
+    double inertia = 0;
+    for (std::size_t j = c * CHUNK; j < std::min(c * CHUNK + CHUNK, n); j++) {
+      Scalar dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        Scalar diff = ch[d][j] - centroids[labels[j] * Dim + d];
+        dist2 += diff * diff;
+      }
+      inertia += weights[j] * (double)dist2;
+    }
+    partial_inertia[c] = inertia;
+  });
+  stats.inertia = 0;
+  for (double inertia : partial_inertia) {
+    stats.inertia += inertia;
+  }
+
+  return clusters;
+}
+
+template <int Dim, typename Scalar>
+bool BasicKMeans<Dim, Scalar>::repair(std::vector<Cluster> &clusters, const std::vector<double> &sums,
+                                      const std::vector<double> &sums_sq, const Scalar *centroids,
+                                      const std::vector<uint32_t> &labels, int threads) const {
+  int k = clusters.size();
+  std::vector<int> empty;
+  for (int i = 0; i < k; i++) {
+    if (clusters[i].count == 0) {
+      empty.push_back(i);
+    }
+  }
+  if (empty.empty()) {
+    return false;
+  }
+
+  bool repaired = false;
+  std::size_t next = 0;
+  if (options.repair == Repair::farthest) {
+    // the points furthest from the centroid they were assigned to, largest first, ties to the lower index. This scans
+    // every point on purpose: the bounds and kd-tree engines skip most distances and the fixed engine only has
+    // quantized ones, and keeping Lloyd's would cost every pass a store per point for the rare pass with an empty
+    // cluster, where the scan is about one k-th of a Lloyd pass
+    std::size_t n = size();
+    std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+    std::vector<std::vector<std::pair<double, std::size_t>>> partial(chunks);
+    auto further = [](const std::pair<double, std::size_t> &a, const std::pair<double, std::size_t> &b) {
+      return a.first > b.first || (a.first == b.first && a.second < b.second);
+    };
+    parallel_for(threads, chunks, [&](std::size_t c) {
+      auto &top = partial[c];
+      for (std::size_t j = c * CHUNK; j < std::min(c * CHUNK + CHUNK, n); j++) {
+        double dist2 = 0;
+        for (int d = 0; d < Dim; d++) {
+          double diff = (double)channels[d][j] - centroids[labels[j] * Dim + d];
+          dist2 += diff * diff;
+        }
+        if (dist2 > REPAIR_MIN_DIST2 && (top.size() < empty.size() || further({dist2, j}, top.back()))) {
+          top.insert(std::upper_bound(top.begin(), top.end(), std::make_pair(dist2, j), further), {dist2, j});
+          if (top.size() > empty.size()) {
+            top.pop_back();
           }
-          clusters[i].centroid[d] = sum / clusters[i].points.size();
         }
       }
+    });
+
+    std::vector<std::pair<double, std::size_t>> farthest;
+    for (auto &top : partial) {
+      farthest.insert(farthest.end(), top.begin(), top.end());
+    }
+    std::sort(farthest.begin(), farthest.end(), further);
+    for (; next < empty.size() && next < farthest.size(); next++) {
+      for (int d = 0; d < Dim; d++) {
+        clusters[empty[next]].centroid[d] = channels[d][farthest[next].second];
+      }
+      repaired = true;
     }
   }
 
-  return clusters;
+  // split the cluster with the largest squared error in two along its direction of largest spread
+  std::vector<double> sse(k, 0);
+  for (int i = 0; i < k; i++) {
+    for (int d = 0; d < Dim && clusters[i].count; d++) {
+      sse[i] += sums_sq[i * Dim + d] - sums[i * Dim + d] * sums[i * Dim + d] / clusters[i].count;
+    }
+  }
+  for (; next < empty.size(); next++) {
+    int worst = -1;
+    for (int i = 0; i < k; i++) {
+      if (clusters[i].count >= 2 && sse[i] > REPAIR_MIN_DIST2 && (worst < 0 || sse[i] > sse[worst])) {
+        worst = i;
+      }
+    }
+    if (worst < 0) {
+      break;
+    }
+
+    int spread = 0;
+    double spread_var = 0;
+    for (int d = 0; d < Dim; d++) {
+      double mean = sums[worst * Dim + d] / clusters[worst].count;
+      double var = sums_sq[worst * Dim + d] / clusters[worst].count - mean * mean;
+      if (var > spread_var) {
+        spread = d;
+        spread_var = var;
+      }
+    }
+    if (!(spread_var > REPAIR_MIN_DIST2)) {
+      break;
+    }
+
+    Cluster &target = clusters[empty[next]];
+    target.centroid = clusters[worst].centroid;
+    target.centroid[spread] += std::sqrt(spread_var) / 2;
+    clusters[worst].centroid[spread] -= std::sqrt(spread_var) / 2;
+    sse[worst] /= 2;
+    repaired = true;
+  }
+
+  // nothing left to split, so the rest sit on their nearest live centroid, where ties keep them from stealing points
+  for (; next < empty.size(); next++) {
+    Cluster &target = clusters[empty[next]];
+    int nearest = -1;
+    double nearest_dist2 = 0;
+    for (int i = 0; i < k; i++) {
+      if (clusters[i].count == 0) {
+        continue;
+      }
+      double dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        double diff = (double)clusters[i].centroid[d] - target.centroid[d];
+        dist2 += diff * diff;
+      }
+      if (nearest < 0 || dist2 < nearest_dist2) {
+        nearest = i;
+        nearest_dist2 = dist2;
+      }
+    }
+    if (nearest >= 0) {
+      target.centroid = clusters[nearest].centroid;
+    }
+  }
+  return repaired;
 }
 
-double KMeans::dist_sq(const Point &a, const Point &b) {
-  double dist2 = 0;
-  for (int i = 0; i < dim; i++) {
-    dist2 += pow(a[i] - b[i], 2);
+template <int Dim, typename Scalar>
+void BasicKMeans<Dim, Scalar>::minibatch(std::vector<Cluster> &clusters, MyRand &rng, KMeansStats &stats) const {
+  std::size_t n = size();
+  int k = clusters.size();
+  int batch_size = std::max(options.batch_size, 1);
+  double tol = options.tol > 0 ? options.tol : MINIBATCH_TOL;
+
+  std::vector<double> centroids(k * Dim);
+  for (int i = 0; i < k; i++) {
+    std::copy(clusters[i].centroid.begin(), clusters[i].centroid.end(), &centroids[i * Dim]);
+  }
+  std::vector<double> seen(k, 0);
+
+  std::array<std::vector<Scalar>, Dim> batch;
+  const Scalar *batch_ch[Dim];
+  for (int d = 0; d < Dim; d++) {
+    batch[d].resize(batch_size);
+    batch_ch[d] = batch[d].data();
+  }
+  std::vector<std::size_t> picked(batch_size);
+  std::vector<uint32_t> nearest(batch_size);
+  std::vector<Scalar> packed(k * Dim);
+
+  int calm = 0;
+  while (calm < MINIBATCH_PATIENCE && stats.batches < (std::size_t)MINIBATCH_MAX_BATCHES) {
+    for (int m = 0; m < batch_size; m++) {
+      picked[m] = rng.randint(0, n);
+      for (int d = 0; d < Dim; d++) {
+        batch[d][m] = channels[d][picked[m]];
+      }
+    }
+
+    // every point of the batch is assigned to the centroids as they were before the batch
+    std::copy(centroids.begin(), centroids.end(), packed.begin());
+    assign_nearest<Dim, Scalar>(batch_ch, 0, batch_size, packed.data(), k, nearest.data());
+    stats.distances += (std::size_t)batch_size * k;
+
+    // per-centroid learning rate: weight of the point over the total weight the centroid has absorbed
+    for (int m = 0; m < batch_size; m++) {
+      uint32_t i = nearest[m];
+      double weight = weights[picked[m]];
+      seen[i] += weight;
+      double rate = weight / seen[i];
+      for (int d = 0; d < Dim; d++) {
+        centroids[i * Dim + d] += rate * (batch[d][m] - centroids[i * Dim + d]);
+      }
+    }
+
+    double max_shift = 0;
+    for (int i = 0; i < k; i++) {
+      double shift2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        double diff = centroids[i * Dim + d] - packed[i * Dim + d];
+        shift2 += diff * diff;
+      }
+      max_shift = std::max(max_shift, std::sqrt(shift2));
+    }
+    calm = max_shift < tol ? calm + 1 : 0;
+    stats.batches++;
   }
-  return sqrt(dist2);
+  // cut off by the batch cap before the centroids settled, reported like the iteration cap of the other engines
+  if (calm < MINIBATCH_PATIENCE) {
+    stats.termination = Termination::max_iter;
+  }
+
+  for (int i = 0; i < k; i++) {
+    for (int d = 0; d < Dim; d++) {
+      clusters[i].centroid[d] = centroids[i * Dim + d];
+    }
+  }
+}
+
+template <int Dim, typename Scalar> void BasicKMeans<Dim, Scalar>::set_options(const KMeansOptions &options) {
+  this->options = options;
 }
+
+template <int Dim, typename Scalar> const KMeansOptions &BasicKMeans<Dim, Scalar>::get_options() const {
+  return options;
+}
+
+template <int Dim, typename Scalar> const std::vector<uint32_t> &BasicKMeans<Dim, Scalar>::get_labels() const {
+  return labels;
+}
+
+template <int Dim, typename Scalar> const KMeansStats &BasicKMeans<Dim, Scalar>::get_stats() const { return stats; }
+
+template class BasicKMeans<1>;
+template class BasicKMeans<2>;
+template class BasicKMeans<3>;
+template class BasicKMeans<4>;
+template class BasicKMeans<1, float>;
+template class BasicKMeans<2, float>;
+template class BasicKMeans<3, float>;
+template class BasicKMeans<4, float>;
+
+KMeans::KMeans(const std::vector<Point> &points, int dim) : points(points) {
+  if (dim < 1 || dim > 4) {
+    throw std::runtime_error("error: unsupported k-means dimension");
+  }
+  this->dim = dim;
+}
+
+std::vector<Cluster> KMeans::cluster(int k) {
+  MyRand rng;
+  return cluster(k, rng);
+}
+
+std::vector<Cluster> KMeans::cluster(int k, MyRand &rng, bool members) {
+  switch (dim) {
+  case 1:
+    return cluster<1>(k, nullptr, rng, members);
+  case 2:
+    return cluster<2>(k, nullptr, rng, members);
+  case 3:
+    return cluster<3>(k, nullptr, rng, members);
+  default:
+    return cluster<4>(k, nullptr, rng, members);
+  }
+}
+
+std::vector<Cluster> KMeans::cluster(int k, const std::vector<Point> &initial, MyRand &rng, bool members) {
+  switch (dim) {
+  case 1:
+    return cluster<1>(k, &initial, rng, members);
+  case 2:
+    return cluster<2>(k, &initial, rng, members);
+  case 3:
+    return cluster<3>(k, &initial, rng, members);
+  default:
+    return cluster<4>(k, &initial, rng, members);
+  }
+}
+
+template <int Dim>
+std::vector<Cluster> KMeans::cluster(int k, const std::vector<Point> *initial, MyRand &rng, bool members) {
+  BasicKMeans<Dim> km(points);
+  km.set_options(options);
+  std::vector<typename BasicKMeans<Dim>::Cluster> result;
+  if (initial) {
+    std::vector<typename BasicKMeans<Dim>::Sample> seeds;
+    for (const Point &point : *initial) {
+      typename BasicKMeans<Dim>::Sample seed;
+      std::copy(point.begin(), point.begin() + Dim, seed.begin());
+      seeds.push_back(seed);
+    }
+    result = km.cluster(k, seeds, rng, members);
+  } else {
+    result = km.cluster(k, rng, members);
+  }
+
+  std::vector<Cluster> clusters;
+  for (auto &cluster : result) {
+    Point centroid(cluster.centroid.begin(), cluster.centroid.end());
+    clusters.push_back(Cluster{std::move(centroid), cluster.count, std::move(cluster.members)});
+  }
+  labels = km.get_labels();
+  stats = km.get_stats();
+  return clusters;
+}
+
+void KMeans::set_options(const KMeansOptions &options) { this->options = options; }
+
+const KMeansOptions &KMeans::get_options() const { return options; }
+
+const std::vector<uint32_t> &KMeans::get_labels() const { return labels; }
+
+const KMeansStats &KMeans::get_stats() const { return stats; }
@@ -0,0 +1,206 @@
+#include "kmeans_bounds.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// squared distance between point j and a centroid, summed in the same order as the assignment kernels
+template <int Dim, typename Scalar>
+Scalar point_dist2(const Scalar *const *channels, std::size_t j, const Scalar *centroid) {
+  Scalar dist2 = 0;
+  for (int d = 0; d < Dim; d++) {
+    Scalar diff = channels[d][j] - centroid[d];
+    dist2 += diff * diff;
+  }
+  return dist2;
+}
+
+template <int Dim, typename Scalar> double centroid_dist(const Scalar *a, const Scalar *b) {
+  double dist2 = 0;
+  for (int d = 0; d < Dim; d++) {
+    double diff = (double)a[d] - (double)b[d];
+    dist2 += diff * diff;
+  }
+  return std::sqrt(dist2);
+}
+
+template <int Dim, typename Scalar>
+DistanceBounds<Dim, Scalar>::DistanceBounds(std::size_t n, int k, bool elkan)
+    : k(k), elkan(elkan), fresh(true), upper(n), lower(elkan ? n * k : n), shift(k), half_min(k),
+      half_dist(elkan ? k * k : 0), max_shift(0), second_shift(0), max_shift_index(-1) {}
+
+template <int Dim, typename Scalar>
+void DistanceBounds<Dim, Scalar>::move_centroids(const Scalar *previous, const Scalar *centroids) {
+  if (previous) {
+    fresh = false;
+    max_shift = 0;
+    second_shift = 0;
+    max_shift_index = -1;
+    for (int i = 0; i < k; i++) {
+      shift[i] = centroid_dist<Dim>(&previous[i * Dim], &centroids[i * Dim]);
+      if (shift[i] > max_shift) {
+        second_shift = max_shift;
+        max_shift = shift[i];
+        max_shift_index = i;
+      } else if (shift[i] > second_shift) {
+        second_shift = shift[i];
+      }
+    }
+  }
+
+  std::fill(half_min.begin(), half_min.end(), std::numeric_limits<double>::infinity());
+  for (int i = 0; i < k; i++) {
+    for (int i2 = i + 1; i2 < k; i2++) {
+      double half = centroid_dist<Dim>(&centroids[i * Dim], &centroids[i2 * Dim]) / 2;
+      half_min[i] = std::min(half_min[i], half);
+      half_min[i2] = std::min(half_min[i2], half);
+      if (elkan) {
+        half_dist[i * k + i2] = half;
+        half_dist[i2 * k + i] = half;
+      }
+    }
+  }
+}
+
+template <int Dim, typename Scalar>
+std::size_t DistanceBounds<Dim, Scalar>::assign(const Scalar *const *channels, std::size_t begin, std::size_t end,
+                                                const Scalar *centroids, uint32_t *labels, std::size_t &distances) {
+  if (elkan) {
+    return assign_elkan(channels, begin, end, centroids, labels, distances);
+  } else {
+    return assign_hamerly(channels, begin, end, centroids, labels, distances);
+  }
+}
+
+template <int Dim, typename Scalar>
+std::size_t DistanceBounds<Dim, Scalar>::assign_hamerly(const Scalar *const *channels, std::size_t begin,
+                                                        std::size_t end, const Scalar *centroids, uint32_t *labels,
+                                                        std::size_t &distances) {
+  std::size_t moved = 0;
+  for (std::size_t j = begin; j < end; j++) {
+    uint32_t a = labels[j];
+
+    if (!fresh) {
+      upper[j] += shift[a];
+      lower[j] -= (int)a == max_shift_index ? second_shift : max_shift;
+
+      double bound = std::max(half_min[a], lower[j]);
+      if (upper[j] < bound) {
+        continue;
+      }
+      upper[j] = std::sqrt(point_dist2<Dim>(channels, j, &centroids[a * Dim]));
+      distances++;
+      if (upper[j] < bound) {
+        continue;
+      }
+    }
+
+    Scalar best = std::numeric_limits<Scalar>::infinity();
+    Scalar second = std::numeric_limits<Scalar>::infinity();
+    uint32_t best_i = 0;
+    for (int i = 0; i < k; i++) {
+      Scalar dist2 = point_dist2<Dim>(channels, j, &centroids[i * Dim]);
+      if (dist2 < best) {
+        second = best;
+        best = dist2;
+        best_i = i;
+      } else if (dist2 < second) {
+        second = dist2;
+      }
+    }
+    distances += k;
+
+    upper[j] = std::sqrt(best);
+    lower[j] = std::sqrt(second);
+    if (a != best_i) {
+      labels[j] = best_i;
+      moved++;
+    }
+  }
+  return moved;
+}
+
+template <int Dim, typename Scalar>
+std::size_t DistanceBounds<Dim, Scalar>::assign_elkan(const Scalar *const *channels, std::size_t begin,
+                                                      std::size_t end, const Scalar *centroids, uint32_t *labels,
+                                                      std::size_t &distances) {
+  std::size_t moved = 0;
+  for (std::size_t j = begin; j < end; j++) {
+    uint32_t a = labels[j];
+    double *l = &lower[j * k];
+
+    if (fresh) {
+      Scalar best = std::numeric_limits<Scalar>::infinity();
+      uint32_t best_i = 0;
+      for (int i = 0; i < k; i++) {
+        Scalar dist2 = point_dist2<Dim>(channels, j, &centroids[i * Dim]);
+        l[i] = std::sqrt(dist2);
+        if (dist2 < best) {
+          best = dist2;
+          best_i = i;
+        }
+      }
+      distances += k;
+
+      upper[j] = std::sqrt(best);
+      if (a != best_i) {
+        labels[j] = best_i;
+        moved++;
+      }
+      continue;
+    }
+
+    upper[j] += shift[a];
+    for (int i = 0; i < k; i++) {
+      l[i] = std::max(l[i] - shift[i], 0.0);
+    }
+    if (upper[j] < half_min[a]) {
+      continue;
+    }
+
+    uint32_t best_i = a;
+    Scalar best = 0;
+    bool stale = true;
+    for (int i = 0; i < k; i++) {
+      if ((uint32_t)i == best_i || upper[j] < l[i] || upper[j] < half_dist[best_i * k + i]) {
+        continue;
+      }
+      if (stale) {
+        best = point_dist2<Dim>(channels, j, &centroids[best_i * Dim]);
+        upper[j] = std::sqrt(best);
+        l[best_i] = upper[j];
+        distances++;
+        stale = false;
+        if (upper[j] < l[i] || upper[j] < half_dist[best_i * k + i]) {
+          continue;
+        }
+      }
+      Scalar dist2 = point_dist2<Dim>(channels, j, &centroids[i * Dim]);
+      l[i] = std::sqrt(dist2);
+      distances++;
+      if (dist2 < best || (dist2 == best && (uint32_t)i < best_i)) {
+        best = dist2;
+        best_i = i;
+        upper[j] = l[i];
+      }
+    }
+
+    if (a != best_i) {
+      labels[j] = best_i;
+      moved++;
+    }
+  }
+  return moved;
+}
+
+template class DistanceBounds<1, double>;
+template class DistanceBounds<2, double>;
+template class DistanceBounds<3, double>;
+template class DistanceBounds<4, double>;
+template class DistanceBounds<1, float>;
+template class DistanceBounds<2, float>;
+template class DistanceBounds<3, float>;
+template class DistanceBounds<4, float>;
@@ -0,0 +1,62 @@
+#include "kmeans_fixed.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+template <int Dim, typename Scalar>
+FixedPoints<Dim, Scalar>::FixedPoints(const Scalar *const *channels, std::size_t n) {
+  double range = 0;
+  for (int d = 0; d < Dim; d++) {
+    auto bounds = std::minmax_element(channels[d], channels[d] + n);
+    low[d] = n ? *bounds.first : 0;
+    range = std::max(range, n ? (double)*bounds.second - low[d] : 0);
+  }
+  scale = range > 0 ? fixed_max(Dim) / range : 1;
+
+  for (int d = 0; d < Dim; d++) {
+    this->channels[d].resize(n);
+    for (std::size_t j = 0; j < n; j++) {
+      this->channels[d][j] = (int16_t)std::lround(((double)channels[d][j] - low[d]) * scale);
+    }
+    pointers[d] = this->channels[d].data();
+  }
+}
+
+template <int Dim, typename Scalar> const int16_t *const *FixedPoints<Dim, Scalar>::data() const { return pointers; }
+
+template <int Dim, typename Scalar> double FixedPoints<Dim, Scalar>::step() const { return 1 / scale; }
+
+template <int Dim, typename Scalar>
+void FixedPoints<Dim, Scalar>::quantize(const Scalar *centroids, int k, int16_t *out) const {
+  // centroids are means of points and stay on the grid, only repaired ones may fall outside and get clamped
+  double top = fixed_max(Dim);
+  for (int i = 0; i < k; i++) {
+    for (int d = 0; d < Dim; d++) {
+      double q = ((double)centroids[i * Dim + d] - low[d]) * scale;
+      out[i * Dim + d] = (int16_t)std::lround(std::min(std::max(q, 0.0), top));
+    }
+  }
+}
+
+template <int Dim, typename Scalar>
+void FixedPoints<Dim, Scalar>::dequantize(const int64_t *fixed_sums, std::size_t count, double *sums,
+                                          double *sums_sq) const {
+  // x = low + q / scale, so sum(x) = low * count + sum(q) / scale and
+  // sum(x^2) = low^2 * count + 2 * low * sum(q) / scale + sum(q^2) / scale^2
+  for (int d = 0; d < Dim; d++) {
+    double sum = (double)fixed_sums[d] / scale;
+    sums[d] = low[d] * count + sum;
+    sums_sq[d] = low[d] * low[d] * count + 2 * low[d] * sum + sums_sq[d] / (scale * scale);
+  }
+}
+
+template class FixedPoints<1, double>;
+template class FixedPoints<2, double>;
+template class FixedPoints<3, double>;
+template class FixedPoints<4, double>;
+template class FixedPoints<1, float>;
+template class FixedPoints<2, float>;
+template class FixedPoints<3, float>;
+template class FixedPoints<4, float>;
@@ -0,0 +1,518 @@
+#include "kmeans_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// points handled per step of the vectorized kernel
+const int BLOCK = 8;
+
+// points and centroids are tiled so that a tile of centroids stays in L1 while a run of points is swept against it
+const std::size_t POINT_RUN = 1024;
+const int CENTROID_TILE = 256;
+
+template <int Dim, typename Scalar>
+std::size_t assign_nearest_scalar(const Scalar *const *channels, std::size_t begin, std::size_t end,
+                                  const Scalar *centroids, int k, uint32_t *labels, Scalar *min_dists) {
+  std::size_t moved = 0;
+  for (std::size_t j = begin; j < end; j++) {
+    Scalar min_dist = std::numeric_limits<Scalar>::infinity();
+    uint32_t min_i = 0;
+    for (int i = 0; i < k; i++) {
+      Scalar dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        Scalar diff = channels[d][j] - centroids[i * Dim + d];
+        dist2 += diff * diff;
+      }
+      if (dist2 < min_dist) {
+        min_dist = dist2;
+        min_i = i;
+      }
+    }
+    if (labels[j] != min_i) {
+      labels[j] = min_i;
+      moved++;
+    }
+    if (min_dists) {
+      min_dists[j] = min_dist;
+    }
+  }
+  return moved;
+}
+
+template <int Dim, typename Scalar>
+void accumulate_dist_scalar(const Scalar *const *channels, std::size_t begin, std::size_t end,
+                            const Scalar *centroid, double *dists) {
+  for (std::size_t j = begin; j < end; j++) {
+    Scalar dist2 = 0;
+    for (int d = 0; d < Dim; d++) {
+      Scalar diff = channels[d][j] - centroid[d];
+      dist2 += diff * diff;
+    }
+    dists[j] += std::sqrt(dist2);
+  }
+}
+
+#if defined(__AVX__)
+
+struct VecDouble {
+  using T = double;
+  using Reg = __m256d;
+  static const int width = 4;
+  static Reg load(const T *p) { return _mm256_loadu_pd(p); }
+  static void store(T *p, Reg a) { _mm256_storeu_pd(p, a); }
+  static Reg set1(T a) { return _mm256_set1_pd(a); }
+  static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+  static Reg sqrt(Reg a) { return _mm256_sqrt_pd(a); }
+  // lanes where a < b take `b_val`, the others keep `a_val`
+  static Reg select_lt(Reg a, Reg b, Reg a_val, Reg b_val) {
+    return _mm256_blendv_pd(a_val, b_val, _mm256_cmp_pd(a, b, _CMP_LT_OQ));
+  }
+};
+
+struct VecFloat {
+  using T = float;
+  using Reg = __m256;
+  static const int width = 8;
+  static Reg load(const T *p) { return _mm256_loadu_ps(p); }
+  static void store(T *p, Reg a) { _mm256_storeu_ps(p, a); }
+  static Reg set1(T a) { return _mm256_set1_ps(a); }
+  static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+  static Reg sqrt(Reg a) { return _mm256_sqrt_ps(a); }
+  static Reg select_lt(Reg a, Reg b, Reg a_val, Reg b_val) {
+    return _mm256_blendv_ps(a_val, b_val, _mm256_cmp_ps(a, b, _CMP_LT_OQ));
+  }
+};
+
+#elif defined(__SSE2__)
+
+struct VecDouble {
+  using T = double;
+  using Reg = __m128d;
+  static const int width = 2;
+  static Reg load(const T *p) { return _mm_loadu_pd(p); }
+  static void store(T *p, Reg a) { _mm_storeu_pd(p, a); }
+  static Reg set1(T a) { return _mm_set1_pd(a); }
+  static Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+  static Reg sqrt(Reg a) { return _mm_sqrt_pd(a); }
+  static Reg select_lt(Reg a, Reg b, Reg a_val, Reg b_val) {
+    Reg mask = _mm_cmplt_pd(a, b);
+    return _mm_or_pd(_mm_and_pd(mask, b_val), _mm_andnot_pd(mask, a_val));
+  }
+};
+
+struct VecFloat {
+  using T = float;
+  using Reg = __m128;
+  static const int width = 4;
+  static Reg load(const T *p) { return _mm_loadu_ps(p); }
+  static void store(T *p, Reg a) { _mm_storeu_ps(p, a); }
+  static Reg set1(T a) { return _mm_set1_ps(a); }
+  static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+  static Reg sqrt(Reg a) { return _mm_sqrt_ps(a); }
+  static Reg select_lt(Reg a, Reg b, Reg a_val, Reg b_val) {
+    Reg mask = _mm_cmplt_ps(a, b);
+    return _mm_or_ps(_mm_and_ps(mask, b_val), _mm_andnot_ps(mask, a_val));
+  }
+};
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+struct VecDouble {
+  using T = double;
+  using Reg = float64x2_t;
+  static const int width = 2;
+  static Reg load(const T *p) { return vld1q_f64(p); }
+  static void store(T *p, Reg a) { vst1q_f64(p, a); }
+  static Reg set1(T a) { return vdupq_n_f64(a); }
+  static Reg add(Reg a, Reg b) { return vaddq_f64(a, b); }
+  static Reg sub(Reg a, Reg b) { return vsubq_f64(a, b); }
+  static Reg mul(Reg a, Reg b) { return vmulq_f64(a, b); }
+  static Reg sqrt(Reg a) { return vsqrtq_f64(a); }
+  static Reg select_lt(Reg a, Reg b, Reg a_val, Reg b_val) { return vbslq_f64(vcltq_f64(a, b), b_val, a_val); }
+};
+
+struct VecFloat {
+  using T = float;
+  using Reg = float32x4_t;
+  static const int width = 4;
+  static Reg load(const T *p) { return vld1q_f32(p); }
+  static void store(T *p, Reg a) { vst1q_f32(p, a); }
+  static Reg set1(T a) { return vdupq_n_f32(a); }
+  static Reg add(Reg a, Reg b) { return vaddq_f32(a, b); }
+  static Reg sub(Reg a, Reg b) { return vsubq_f32(a, b); }
+  static Reg mul(Reg a, Reg b) { return vmulq_f32(a, b); }
+  static Reg sqrt(Reg a) { return vsqrtq_f32(a); }
+  static Reg select_lt(Reg a, Reg b, Reg a_val, Reg b_val) { return vbslq_f32(vcltq_f32(a, b), b_val, a_val); }
+};
+
+#endif
+
+// vector policy for a scalar type, void where only the scalar kernels are available
+template <typename Scalar> struct VecOf {
+  using type = void;
+};
+
+#if defined(__AVX__) || defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+template <> struct VecOf<double> {
+  using type = VecDouble;
+};
+
+template <> struct VecOf<float> {
+  using type = VecFloat;
+};
+#endif
+
+// Sweep one block of BLOCK points against centroids [i0, i1), updating the running best distance and index.
+// Distances are summed in the same order as assign_nearest_scalar() so both give identical labels.
+template <typename V, int Dim>
+void nearest_block(const typename V::T *const *channels, std::size_t j, const typename V::T *centroids, int i0, int i1,
+                   typename V::T *best_dist, typename V::T *best_index) {
+  using Reg = typename V::Reg;
+  const int U = BLOCK / V::width;
+
+  Reg p[Dim][U];
+  Reg bd[U];
+  Reg bi[U];
+  for (int u = 0; u < U; u++) {
+    for (int d = 0; d < Dim; d++) {
+      p[d][u] = V::load(channels[d] + j + u * V::width);
+    }
+    bd[u] = V::load(best_dist + u * V::width);
+    bi[u] = V::load(best_index + u * V::width);
+  }
+
+  for (int i = i0; i < i1; i++) {
+    Reg c[Dim];
+    for (int d = 0; d < Dim; d++) {
+      c[d] = V::set1(centroids[i * Dim + d]);
+    }
+    Reg index = V::set1((typename V::T)i);
+    for (int u = 0; u < U; u++) {
+      Reg diff = V::sub(p[0][u], c[0]);
+      Reg dist2 = V::mul(diff, diff);
+      for (int d = 1; d < Dim; d++) {
+        diff = V::sub(p[d][u], c[d]);
+        dist2 = V::add(dist2, V::mul(diff, diff));
+      }
+      bi[u] = V::select_lt(dist2, bd[u], bi[u], index);
+      bd[u] = V::select_lt(dist2, bd[u], bd[u], dist2);
+    }
+  }
+
+  for (int u = 0; u < U; u++) {
+    V::store(best_dist + u * V::width, bd[u]);
+    V::store(best_index + u * V::width, bi[u]);
+  }
+}
+
+template <typename V, int Dim>
+std::size_t assign_nearest_vec(const typename V::T *const *channels, std::size_t begin, std::size_t end,
+                               const typename V::T *centroids, int k, uint32_t *labels, typename V::T *min_dists) {
+  using T = typename V::T;
+
+  std::size_t moved = 0;
+  T best_dist[POINT_RUN];
+  T best_index[POINT_RUN];
+
+  std::size_t vec_end = begin + (end - begin) / BLOCK * BLOCK;
+  for (std::size_t run = begin; run < vec_end; run += POINT_RUN) {
+    std::size_t run_end = std::min(run + POINT_RUN, vec_end);
+    std::size_t len = run_end - run;
+    std::fill(best_dist, best_dist + len, std::numeric_limits<T>::infinity());
+    std::fill(best_index, best_index + len, 0);
+
+    for (int i0 = 0; i0 < k; i0 += CENTROID_TILE) {
+      int i1 = std::min(i0 + CENTROID_TILE, k);
+      for (std::size_t j = run; j < run_end; j += BLOCK) {
+        nearest_block<V, Dim>(channels, j, centroids, i0, i1, best_dist + (j - run), best_index + (j - run));
+      }
+    }
+
+    for (std::size_t j = run; j < run_end; j++) {
+      uint32_t min_i = (uint32_t)best_index[j - run];
+      if (labels[j] != min_i) {
+        labels[j] = min_i;
+        moved++;
+      }
+      if (min_dists) {
+        min_dists[j] = best_dist[j - run];
+      }
+    }
+  }
+
+  return moved + assign_nearest_scalar<Dim, T>(channels, vec_end, end, centroids, k, labels, min_dists);
+}
+
+template <typename V, int Dim>
+void accumulate_dist_vec(const typename V::T *const *channels, std::size_t begin, std::size_t end,
+                         const typename V::T *centroid, double *dists) {
+  using Reg = typename V::Reg;
+
+  Reg c[Dim];
+  for (int d = 0; d < Dim; d++) {
+    c[d] = V::set1(centroid[d]);
+  }
+
+  std::size_t vec_end = begin + (end - begin) / V::width * V::width;
+  for (std::size_t j = begin; j < vec_end; j += V::width) {
+    Reg diff = V::sub(V::load(channels[0] + j), c[0]);
+    Reg dist2 = V::mul(diff, diff);
+    for (int d = 1; d < Dim; d++) {
+      diff = V::sub(V::load(channels[d] + j), c[d]);
+      dist2 = V::add(dist2, V::mul(diff, diff));
+    }
+    if constexpr (std::is_same<typename V::T, double>::value) {
+      V::store(dists + j, V::add(V::load(dists + j), V::sqrt(dist2)));
+    } else {
+      // the running sums stay in double, so single-precision lanes are widened one by one
+      typename V::T dist[V::width];
+      V::store(dist, V::sqrt(dist2));
+      for (int l = 0; l < V::width; l++) {
+        dists[j + l] += dist[l];
+      }
+    }
+  }
+
+  accumulate_dist_scalar<Dim, typename V::T>(channels, vec_end, end, centroid, dists);
+}
+
+template <int Dim, typename Scalar>
+std::size_t assign_nearest(const Scalar *const *channels, std::size_t begin, std::size_t end, const Scalar *centroids,
+                           int k, uint32_t *labels, Scalar *min_dists) {
+  using V = typename VecOf<Scalar>::type;
+  if constexpr (std::is_void<V>::value) {
+    return assign_nearest_scalar<Dim, Scalar>(channels, begin, end, centroids, k, labels, min_dists);
+  } else {
+    return assign_nearest_vec<V, Dim>(channels, begin, end, centroids, k, labels, min_dists);
+  }
+}
+
+template <int Dim, typename Scalar>
+void accumulate_dist(const Scalar *const *channels, std::size_t begin, std::size_t end, const Scalar *centroid,
+                     double *dists) {
+  using V = typename VecOf<Scalar>::type;
+  if constexpr (std::is_void<V>::value) {
+    accumulate_dist_scalar<Dim, Scalar>(channels, begin, end, centroid, dists);
+  } else {
+    accumulate_dist_vec<V, Dim>(channels, begin, end, centroid, dists);
+  }
+}
+
+template <int Dim>
+std::size_t assign_nearest_fixed_scalar(const int16_t *const *channels, std::size_t begin, std::size_t end,
+                                        const int16_t *centroids, int k, uint32_t *labels) {
+  std::size_t moved = 0;
+  for (std::size_t j = begin; j < end; j++) {
+    int32_t min_dist = INT32_MAX;
+    uint32_t min_i = 0;
+    for (int i = 0; i < k; i++) {
+      int32_t dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        int32_t diff = channels[d][j] - centroids[i * Dim + d];
+        dist2 += diff * diff;
+      }
+      if (dist2 < min_dist) {
+        min_dist = dist2;
+        min_i = i;
+      }
+    }
+    if (labels[j] != min_i) {
+      labels[j] = min_i;
+      moved++;
+    }
+  }
+  return moved;
+}
+
+// Integer policies for the fixed kernel: Reg holds `width` int16 coordinates, Dist half of them as int32 distances or
+// indices, and square_pairs() adds the squares of two coordinates per point with one multiply-add.
+
+#if defined(__AVX2__)
+
+struct VecFixed {
+  using Reg = __m256i;
+  using Dist = __m256i;
+  static const int width = 16;
+  // the middle 64-bit quarters are swapped, so that the in-lane unpacks of square_pairs() yield points in order
+  static Reg load(const int16_t *p) {
+    return _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)p), 0xD8);
+  }
+  static Reg set1(int16_t a) { return _mm256_set1_epi16(a); }
+  static Reg zero() { return _mm256_setzero_si256(); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_epi16(a, b); }
+  // add a^2 + b^2 onto `lo` for the first half of the points and onto `hi` for the second
+  static void square_pairs(Reg a, Reg b, Dist &lo, Dist &hi) {
+    Reg l = _mm256_unpacklo_epi16(a, b);
+    Reg h = _mm256_unpackhi_epi16(a, b);
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(l, l));
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(h, h));
+  }
+  static Dist load_dist(const int32_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+  static void store_dist(int32_t *p, Dist a) { _mm256_storeu_si256((__m256i *)p, a); }
+  static Dist set1_dist(int32_t a) { return _mm256_set1_epi32(a); }
+  static Dist select_lt(Dist a, Dist b, Dist a_val, Dist b_val) {
+    return _mm256_blendv_epi8(a_val, b_val, _mm256_cmpgt_epi32(b, a));
+  }
+};
+
+#elif defined(__SSE2__)
+
+struct VecFixed {
+  using Reg = __m128i;
+  using Dist = __m128i;
+  static const int width = 8;
+  static Reg load(const int16_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+  static Reg set1(int16_t a) { return _mm_set1_epi16(a); }
+  static Reg zero() { return _mm_setzero_si128(); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_epi16(a, b); }
+  static void square_pairs(Reg a, Reg b, Dist &lo, Dist &hi) {
+    Reg l = _mm_unpacklo_epi16(a, b);
+    Reg h = _mm_unpackhi_epi16(a, b);
+    lo = _mm_add_epi32(lo, _mm_madd_epi16(l, l));
+    hi = _mm_add_epi32(hi, _mm_madd_epi16(h, h));
+  }
+  static Dist load_dist(const int32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+  static void store_dist(int32_t *p, Dist a) { _mm_storeu_si128((__m128i *)p, a); }
+  static Dist set1_dist(int32_t a) { return _mm_set1_epi32(a); }
+  static Dist select_lt(Dist a, Dist b, Dist a_val, Dist b_val) {
+    Dist mask = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(mask, b_val), _mm_andnot_si128(mask, a_val));
+  }
+};
+
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+// Sweep V::width points starting at j against centroids [i0, i1). Distances are exact, so labels match
+// assign_nearest_fixed_scalar().
+template <typename V, int Dim>
+void nearest_block_fixed(const int16_t *const *channels, std::size_t j, const int16_t *centroids, int i0, int i1,
+                         int32_t *best_dist, int32_t *best_index) {
+  using Reg = typename V::Reg;
+  using Dist = typename V::Dist;
+  const int half = V::width / 2;
+
+  Reg p[Dim];
+  for (int d = 0; d < Dim; d++) {
+    p[d] = V::load(channels[d] + j);
+  }
+  Dist bd[2] = {V::load_dist(best_dist), V::load_dist(best_dist + half)};
+  Dist bi[2] = {V::load_dist(best_index), V::load_dist(best_index + half)};
+
+  for (int i = i0; i < i1; i++) {
+    Reg diff[Dim];
+    for (int d = 0; d < Dim; d++) {
+      diff[d] = V::sub(p[d], V::set1(centroids[i * Dim + d]));
+    }
+    Dist dist2[2] = {V::set1_dist(0), V::set1_dist(0)};
+    for (int d = 0; d < Dim; d += 2) {
+      V::square_pairs(diff[d], d + 1 < Dim ? diff[d + 1] : V::zero(), dist2[0], dist2[1]);
+    }
+    Dist index = V::set1_dist(i);
+    for (int h = 0; h < 2; h++) {
+      bi[h] = V::select_lt(dist2[h], bd[h], bi[h], index);
+      bd[h] = V::select_lt(dist2[h], bd[h], bd[h], dist2[h]);
+    }
+  }
+
+  for (int h = 0; h < 2; h++) {
+    V::store_dist(best_dist + h * half, bd[h]);
+    V::store_dist(best_index + h * half, bi[h]);
+  }
+}
+
+template <typename V, int Dim>
+std::size_t assign_nearest_fixed_vec(const int16_t *const *channels, std::size_t begin, std::size_t end,
+                                     const int16_t *centroids, int k, uint32_t *labels) {
+  std::size_t moved = 0;
+  int32_t best_dist[POINT_RUN];
+  int32_t best_index[POINT_RUN];
+
+  std::size_t vec_end = begin + (end - begin) / V::width * V::width;
+  for (std::size_t run = begin; run < vec_end; run += POINT_RUN) {
+    std::size_t run_end = std::min(run + POINT_RUN, vec_end);
+    std::size_t len = run_end - run;
+    std::fill(best_dist, best_dist + len, INT32_MAX);
+    std::fill(best_index, best_index + len, 0);
+
+    for (int i0 = 0; i0 < k; i0 += CENTROID_TILE) {
+      int i1 = std::min(i0 + CENTROID_TILE, k);
+      for (std::size_t j = run; j < run_end; j += V::width) {
+        nearest_block_fixed<V, Dim>(channels, j, centroids, i0, i1, best_dist + (j - run), best_index + (j - run));
+      }
+    }
+
+    for (std::size_t j = run; j < run_end; j++) {
+      uint32_t min_i = (uint32_t)best_index[j - run];
+      if (labels[j] != min_i) {
+        labels[j] = min_i;
+        moved++;
+      }
+    }
+  }
+
+  return moved + assign_nearest_fixed_scalar<Dim>(channels, vec_end, end, centroids, k, labels);
+}
+
+#endif
+
+template <int Dim>
+std::size_t assign_nearest_fixed(const int16_t *const *channels, std::size_t begin, std::size_t end,
+                                 const int16_t *centroids, int k, uint32_t *labels) {
+#if defined(__AVX2__) || defined(__SSE2__)
+  return assign_nearest_fixed_vec<VecFixed, Dim>(channels, begin, end, centroids, k, labels);
+#else
+  return assign_nearest_fixed_scalar<Dim>(channels, begin, end, centroids, k, labels);
+#endif
+}
+
+#define INSTANTIATE_KERNELS(Dim, Scalar)                                                                               \
+  template std::size_t assign_nearest<Dim, Scalar>(const Scalar *const *, std::size_t, std::size_t, const Scalar *,  \
+                                                   int, uint32_t *, Scalar *);                                         \
+  template std::size_t assign_nearest_scalar<Dim, Scalar>(const Scalar *const *, std::size_t, std::size_t,            \
+                                                          const Scalar *, int, uint32_t *, Scalar *);                  \
+  template void accumulate_dist<Dim, Scalar>(const Scalar *const *, std::size_t, std::size_t, const Scalar *,          \
+                                             double *);                                                                \
+  template void accumulate_dist_scalar<Dim, Scalar>(const Scalar *const *, std::size_t, std::size_t, const Scalar *,  \
+                                                    double *);
+
+INSTANTIATE_KERNELS(1, double)
+INSTANTIATE_KERNELS(2, double)
+INSTANTIATE_KERNELS(3, double)
+INSTANTIATE_KERNELS(4, double)
+INSTANTIATE_KERNELS(1, float)
+INSTANTIATE_KERNELS(2, float)
+INSTANTIATE_KERNELS(3, float)
+INSTANTIATE_KERNELS(4, float)
+
+#define INSTANTIATE_FIXED_KERNELS(Dim)                                                                                 \
+  template std::size_t assign_nearest_fixed<Dim>(const int16_t *const *, std::size_t, std::size_t, const int16_t *,  \
+                                                 int, uint32_t *);                                                     \
+  template std::size_t assign_nearest_fixed_scalar<Dim>(const int16_t *const *, std::size_t, std::size_t,             \
+                                                        const int16_t *, int, uint32_t *);
+
+INSTANTIATE_FIXED_KERNELS(1)
+INSTANTIATE_FIXED_KERNELS(2)
+INSTANTIATE_FIXED_KERNELS(3)
+INSTANTIATE_FIXED_KERNELS(4)
@@ -0,0 +1,269 @@
+#include "kmeans_seeding.h"
+#include "kmeans.h"
+#include "kmeans_kernel.h"
+#include "myrand.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// k-means|| settings: rounds of oversampling and expected candidates per round, in multiples of k
+const int PARALLEL_ROUNDS = 5;
+const int PARALLEL_OVERSAMPLING = 2;
+
+// Lloyd iterations spent reducing the k-means|| candidates
+const int PARALLEL_RECLUSTER_ITER = 100;
+
+template <int Dim, typename Scalar> std::array<Scalar, Dim> sample_at(const Scalar *const *channels, std::size_t j) {
+  std::array<Scalar, Dim> sample;
+  for (int d = 0; d < Dim; d++) {
+    sample[d] = channels[d][j];
+  }
+  return sample;
+}
+
+// Lower min_dist2 of points [begin, end) to their squared distance from any of `seeds`, returning the weighted cost.
+template <int Dim, typename Scalar>
+double update_min_dist(const Scalar *const *channels, const uint32_t *weights, std::size_t begin, std::size_t end,
+                       const std::array<Scalar, Dim> *seeds, std::size_t count, double *min_dist2) {
+  double cost = 0;
+  for (std::size_t j = begin; j < end; j++) {
+    double best = min_dist2[j];
+    for (std::size_t s = 0; s < count; s++) {
+      Scalar dist2 = 0;
+      for (int d = 0; d < Dim; d++) {
+        Scalar diff = channels[d][j] - seeds[s][d];
+        dist2 += diff * diff;
+      }
+      best = std::min(best, (double)dist2);
+    }
+    min_dist2[j] = best;
+    cost += weights[j] * best;
+  }
+  return cost;
+}
+
+// Draw a point with probability proportional to weight times `cost` (or just weight when `cost` is null).
+// `partial` holds the total of each chunk, which lets the scan skip straight to the right chunk.
+std::size_t weighted_pick(double r, const uint32_t *weights, const double *cost, std::size_t n,
+                          const std::vector<double> &partial) {
+  std::size_t c = 0;
+  while (c + 1 < partial.size() && r >= partial[c]) {
+    r -= partial[c];
+    c++;
+  }
+
+  std::size_t end = std::min(c * CHUNK + CHUNK, n);
+  std::size_t last = end - 1;
+  for (std::size_t j = c * CHUNK; j < end; j++) {
+    double w = cost ? weights[j] * cost[j] : weights[j];
+    if (w > 0) {
+      last = j;
+      if (r < w) {
+        return j;
+      }
+      r -= w;
+    }
+  }
+  // rounding left a sliver of `r`, fall back to the last point that could have been drawn
+  return last;
+}
+
+std::size_t first_seed(const uint32_t *weights, std::size_t n, MyRand &rng, std::size_t chunks) {
+  std::vector<double> partial(chunks, 0);
+  for (std::size_t j = 0; j < n; j++) {
+    partial[j / CHUNK] += weights[j];
+  }
+  double total = 0;
+  for (double w : partial) {
+    total += w;
+  }
+  return weighted_pick(rng.uniform(0, total), weights, nullptr, n, partial);
+}
+
+template <int Dim, typename Scalar>
+std::vector<std::array<Scalar, Dim>> seed_farthest(const Scalar *const *channels, const uint32_t *weights,
+                                                   std::size_t n, int k, MyRand &rng, int threads) {
+  std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+  std::vector<std::array<Scalar, Dim>> seeds;
+  std::vector<bool> chosen(n, false);
+  std::vector<double> dists(n, 0);
+
+  std::size_t last_centroid = first_seed(weights, n, rng, chunks);
+  chosen[last_centroid] = true;
+  seeds.push_back(sample_at<Dim>(channels, last_centroid));
+
+  for (int i = 1; i < k; i++) {
+    const Scalar *centroid = seeds.back().data();
+    parallel_for(threads, chunks, [&](std::size_t c) {
+      accumulate_dist<Dim, Scalar>(channels, c * CHUNK, std::min(c * CHUNK + CHUNK, n), centroid, dists.data());
+    });
+
+    // a histogram bin counts as often as the pixels it stands for, so a lone outlier does not beat a dominant color
+    double maxDist = 0;
+    std::size_t maxJ = n;
+    for (std::size_t j = 0; j < n; j++) {
+      double score = dists[j] * weights[j];
+      if (score > maxDist && !chosen[j]) {
+        maxDist = score;
+        maxJ = j;
+      }
+    }
+
+    if (maxJ != n) {
+      last_centroid = maxJ;
+      chosen[last_centroid] = true;
+      seeds.push_back(sample_at<Dim>(channels, last_centroid));
+    }
+  }
+
+  return seeds;
+}
+
+template <int Dim, typename Scalar>
+std::vector<std::array<Scalar, Dim>> seed_kmeanspp(const Scalar *const *channels, const uint32_t *weights,
+                                                   std::size_t n, int k, MyRand &rng, int threads) {
+  std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+  std::vector<std::array<Scalar, Dim>> seeds;
+  std::vector<double> min_dist2(n, std::numeric_limits<double>::infinity());
+  std::vector<double> partial(chunks);
+
+  seeds.push_back(sample_at<Dim>(channels, first_seed(weights, n, rng, chunks)));
+
+  for (int i = 1; i < k; i++) {
+    parallel_for(threads, chunks, [&](std::size_t c) {
+      partial[c] = update_min_dist<Dim>(channels, weights, c * CHUNK, std::min(c * CHUNK + CHUNK, n), &seeds.back(),
+                                        1, min_dist2.data());
+    });
+
+    double total = 0;
+    for (double cost : partial) {
+      total += cost;
+    }
+    // every point already sits on a seed
+    if (!(total > 0)) {
+      break;
+    }
+
+    std::size_t j = weighted_pick(rng.uniform(0, total), weights, min_dist2.data(), n, partial);
+    seeds.push_back(sample_at<Dim>(channels, j));
+  }
+
+  return seeds;
+}
+
+template <int Dim, typename Scalar>
+std::vector<std::array<Scalar, Dim>> seed_parallel(const Scalar *const *channels, const uint32_t *weights,
+                                                   std::size_t n, int k, MyRand &rng, int threads) {
+  std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+  std::vector<std::array<Scalar, Dim>> candidates;
+  std::vector<double> min_dist2(n, std::numeric_limits<double>::infinity());
+  std::vector<double> partial(chunks);
+  std::vector<std::vector<uint32_t>> picked(chunks);
+
+  candidates.push_back(sample_at<Dim>(channels, first_seed(weights, n, rng, chunks)));
+  std::size_t fresh = 0;
+
+  for (int round = 0; round < PARALLEL_ROUNDS; round++) {
+    // only the candidates drawn last round can lower the distances; those of the final round are never measured,
+    // as the reduction below assigns every point to its nearest candidate anyway
+    std::size_t count = candidates.size() - fresh;
+    parallel_for(threads, chunks, [&](std::size_t c) {
+      partial[c] = update_min_dist<Dim>(channels, weights, c * CHUNK, std::min(c * CHUNK + CHUNK, n),
+                                        &candidates[fresh], count, min_dist2.data());
+    });
+
+    double total = 0;
+    for (double cost : partial) {
+      total += cost;
+    }
+    if (!(total > 0)) {
+      break;
+    }
+
+    // every chunk draws from its own stream derived from the shared one, so picks do not depend on thread count
+    unsigned int base = rng.randint(0, std::numeric_limits<int>::max());
+    double scale = (double)PARALLEL_OVERSAMPLING * k / total;
+    parallel_for(threads, chunks, [&](std::size_t c) {
+      MyRand chunk_rng(base + (unsigned int)c);
+      picked[c].clear();
+      for (std::size_t j = c * CHUNK; j < std::min(c * CHUNK + CHUNK, n); j++) {
+        if (chunk_rng.uniform(0, 1) < scale * weights[j] * min_dist2[j]) {
+          picked[c].push_back(j);
+        }
+      }
+    });
+
+    fresh = candidates.size();
+    for (auto &chunk : picked) {
+      for (uint32_t j : chunk) {
+        candidates.push_back(sample_at<Dim>(channels, j));
+      }
+    }
+  }
+
+  int m = candidates.size();
+  if (m <= k) {
+    return candidates;
+  }
+
+  // weigh each candidate by the points closest to it and reduce the candidates to k seeds
+  std::vector<Scalar> packed(m * Dim);
+  for (int i = 0; i < m; i++) {
+    std::copy(candidates[i].begin(), candidates[i].end(), &packed[i * Dim]);
+  }
+  std::vector<uint32_t> nearest(n, m);
+  std::vector<double> partial_weights(chunks * m, 0);
+  parallel_for(threads, chunks, [&](std::size_t c) {
+    std::size_t begin = c * CHUNK;
+    std::size_t end = std::min(begin + CHUNK, n);
+    assign_nearest<Dim, Scalar>(channels, begin, end, packed.data(), m, nearest.data());
+    for (std::size_t j = begin; j < end; j++) {
+      partial_weights[c * m + nearest[j]] += weights[j];
+    }
+  });
+
+  BasicKMeans<Dim, Scalar> reduced;
+  reduced.reserve(m);
+  for (int i = 0; i < m; i++) {
+    double weight = 0;
+    for (std::size_t c = 0; c < chunks; c++) {
+      weight += partial_weights[c * m + i];
+    }
+    if (weight > 0) {
+      reduced.push_back(candidates[i], (uint32_t)std::min<double>(weight, std::numeric_limits<uint32_t>::max()));
+    }
+  }
+
+  KMeansOptions options;
+  options.seeding = Seeding::kmeanspp;
+  options.max_iter = PARALLEL_RECLUSTER_ITER;
+  reduced.set_options(options);
+
+  std::vector<std::array<Scalar, Dim>> seeds;
+  for (auto &cluster : reduced.cluster(std::min<int>(k, reduced.size()), rng)) {
+    seeds.push_back(cluster.centroid);
+  }
+  return seeds;
+}
+
+#define INSTANTIATE_SEEDING(Dim, Scalar)                                                                               \
+  template std::vector<std::array<Scalar, Dim>> seed_farthest<Dim, Scalar>(const Scalar *const *, const uint32_t *,  \
+                                                                           std::size_t, int, MyRand &, int);           \
+  template std::vector<std::array<Scalar, Dim>> seed_kmeanspp<Dim, Scalar>(const Scalar *const *, const uint32_t *,  \
+                                                                           std::size_t, int, MyRand &, int);           \
+  template std::vector<std::array<Scalar, Dim>> seed_parallel<Dim, Scalar>(const Scalar *const *, const uint32_t *,  \
+                                                                           std::size_t, int, MyRand &, int);
+
+INSTANTIATE_SEEDING(1, double)
+INSTANTIATE_SEEDING(2, double)
+INSTANTIATE_SEEDING(3, double)
+INSTANTIATE_SEEDING(4, double)
+INSTANTIATE_SEEDING(1, float)
+INSTANTIATE_SEEDING(2, float)
+INSTANTIATE_SEEDING(3, float)
+INSTANTIATE_SEEDING(4, float)
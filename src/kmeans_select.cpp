@@ -0,0 +1,168 @@
+#include "kmeans_select.h"
+#include "kmeans.h"
+#include "myrand.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// reference data sets drawn for the gap statistic
+const int GAP_REFERENCES = 5;
+
+// Weighted mean over every point of (b - a) / max(a, b), where a and b are the distances to the nearest and second
+// nearest centroid. This stands in for the silhouette without any point-to-point distances.
+template <int Dim, typename Scalar>
+double simplified_silhouette(const BasicKMeans<Dim, Scalar> &km, const std::vector<BasicCluster<Dim, Scalar>> &clusters,
+                             int threads) {
+  std::size_t n = km.size();
+  int k = clusters.size();
+  if (k < 2 || n == 0) {
+    return 0;
+  }
+
+  const Scalar *ch[Dim];
+  for (int d = 0; d < Dim; d++) {
+    ch[d] = km.channel(d);
+  }
+  const uint32_t *weights = km.get_weights();
+
+  std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+  std::vector<double> partial(chunks);
+  std::vector<double> partial_weight(chunks);
+  parallel_for(threads, chunks, [&](std::size_t c) {
+    double sum = 0;
+    double weight = 0;
+    for (std::size_t j = c * CHUNK; j < std::min(c * CHUNK + CHUNK, n); j++) {
+      double nearest = std::numeric_limits<double>::infinity();
+      double second = std::numeric_limits<double>::infinity();
+      for (int i = 0; i < k; i++) {
+        double dist2 = 0;
+        for (int d = 0; d < Dim; d++) {
+          double diff = (double)ch[d][j] - clusters[i].centroid[d];
+          dist2 += diff * diff;
+        }
+        if (dist2 < nearest) {
+          second = nearest;
+          nearest = dist2;
+        } else if (dist2 < second) {
+          second = dist2;
+        }
+      }
+      double a = std::sqrt(nearest);
+      double b = std::sqrt(second);
+      if (b > 0) {
+        sum += weights[j] * (b - a) / b;
+      }
+      weight += weights[j];
+    }
+    partial[c] = sum;
+    partial_weight[c] = weight;
+  });
+
+  double sum = 0;
+  double weight = 0;
+  for (std::size_t c = 0; c < chunks; c++) {
+    sum += partial[c];
+    weight += partial_weight[c];
+  }
+  return weight > 0 ? sum / weight : 0;
+}
+
+template <int Dim, typename Scalar>
+KSelection<Dim, Scalar> select_k(BasicKMeans<Dim, Scalar> &km, int min_k, int max_k, Criterion criterion,
+                                 MyRand &rng) {
+  KSelection<Dim, Scalar> selection;
+  for (int k = min_k; k <= max_k; k++) {
+    selection.ks.push_back(k);
+  }
+  selection.clusters = km.cluster_each(selection.ks, rng, selection.stats);
+  std::size_t count = selection.ks.size();
+
+  if (criterion == Criterion::elbow) {
+    // inertia falls with k, both axes are scaled to [0, 1] so the line runs from (0, 1) to (1, 0)
+    double first = selection.stats.front().inertia;
+    double last = selection.stats.back().inertia;
+    for (std::size_t i = 0; i < count; i++) {
+      double x = count > 1 ? (double)i / (count - 1) : 0;
+      double y = first > last ? (selection.stats[i].inertia - last) / (first - last) : 0;
+      selection.scores.push_back(1 - x - y);
+    }
+    selection.chosen = std::max_element(selection.scores.begin(), selection.scores.end()) - selection.scores.begin();
+  } else if (criterion == Criterion::silhouette) {
+    int threads = thread_count(km.get_options().threads);
+    for (const auto &clusters : selection.clusters) {
+      selection.scores.push_back(simplified_silhouette(km, clusters, threads));
+    }
+    selection.chosen = std::max_element(selection.scores.begin(), selection.scores.end()) - selection.scores.begin();
+  } else {
+    // reference sets are uniform over the bounding box of the points, each point keeping its weight
+    std::size_t n = km.size();
+    std::array<std::pair<Scalar, Scalar>, Dim> limits;
+    for (int d = 0; d < Dim; d++) {
+      auto minmax = std::minmax_element(km.channel(d), km.channel(d) + n);
+      limits[d] = {*minmax.first, *minmax.second};
+    }
+
+    std::vector<std::vector<double>> log_w(count);
+    for (int b = 0; b < GAP_REFERENCES; b++) {
+      BasicKMeans<Dim, Scalar> reference;
+      reference.set_options(km.get_options());
+      reference.reserve(n);
+      for (std::size_t j = 0; j < n; j++) {
+        typename BasicKMeans<Dim, Scalar>::Sample sample;
+        for (int d = 0; d < Dim; d++) {
+          sample[d] = rng.uniform(limits[d].first, limits[d].second);
+        }
+        reference.push_back(sample, km.get_weights()[j]);
+      }
+      std::vector<KMeansStats> reference_stats;
+      reference.cluster_each(selection.ks, rng, reference_stats);
+      for (std::size_t i = 0; i < count; i++) {
+        log_w[i].push_back(std::log(std::max(reference_stats[i].inertia, std::numeric_limits<double>::min())));
+      }
+    }
+
+    for (std::size_t i = 0; i < count; i++) {
+      double mean = 0;
+      for (double l : log_w[i]) {
+        mean += l;
+      }
+      mean /= GAP_REFERENCES;
+      double var = 0;
+      for (double l : log_w[i]) {
+        var += (l - mean) * (l - mean);
+      }
+      var /= GAP_REFERENCES;
+      double inertia = std::max(selection.stats[i].inertia, std::numeric_limits<double>::min());
+      selection.scores.push_back(mean - std::log(inertia));
+      selection.errors.push_back(std::sqrt(var * (1 + 1.0 / GAP_REFERENCES)));
+    }
+
+    selection.chosen = count - 1;
+    for (std::size_t i = 0; i + 1 < count; i++) {
+      if (selection.scores[i] >= selection.scores[i + 1] - selection.errors[i + 1]) {
+        selection.chosen = i;
+        break;
+      }
+    }
+  }
+
+  return selection;
+}
+
+#define INSTANTIATE_SELECT(Dim, Scalar)                                                                                \
+  template KSelection<Dim, Scalar> select_k<Dim, Scalar>(BasicKMeans<Dim, Scalar> &, int, int, Criterion, MyRand &);
+
+INSTANTIATE_SELECT(1, double)
+INSTANTIATE_SELECT(2, double)
+INSTANTIATE_SELECT(3, double)
+INSTANTIATE_SELECT(4, double)
+INSTANTIATE_SELECT(1, float)
+INSTANTIATE_SELECT(2, float)
+INSTANTIATE_SELECT(3, float)
+INSTANTIATE_SELECT(4, float)
@@ -5,6 +5,7 @@
 #include <fmt/core.h>
 
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
@@ -18,9 +19,35 @@ const char *HELP_MSG = "Usage: {} [OPTION] FILE\n"
                        "  -c, --color         enable colorful printing\n"
                        "  -h, --help          display this help and exit\n"
                        "  -n lines            max output lines\n"
+                       "  -v, --verbose       print k-means statistics to stderr\n"
                        "  --sample samples    sample size\n"
-                       "  --cluster clusters  number of clusters for k-means algorithm\n"
-                       "  --seed seed         RNG seed, negative for random seed\n";
+                       "  --cluster clusters  number of clusters for k-means algorithm, a comma\n"
+                       "                      separated list printing one palette per count, or\n"
+                       "                      auto[:min-max] to pick one from min-max (default 2-12)\n"
+                       "  --criterion name    how auto picks: elbow (default), silhouette or gap\n"
+                       "  --engine engine     k-means engine: lloyd (default), hamerly, elkan,\n"
+                       "                      bounds, kdtree, minibatch, bisecting or fixed (Lloyd\n"
+                       "                      on int16 points); octree or wu quantize every pixel\n"
+                       "                      without k-means\n"
+                       "  --batch size        batch size for the minibatch engine\n"
+                       "  --histogram bits    cluster all pixels via an RGB histogram with 1-8 bits per channel\n"
+                       "  --space space       color space k-means clusters in: lab (default), oklab or rgb\n"
+                       "  --lab-table file    convert pixels to Lab through a lookup grid shared between\n"
+                       "                      processes via this file, built when missing or stale\n"
+                       "  --lab-cells n       grid cells per axis of the lookup grid (default 64)\n"
+                       "  --order curve       sort k-means points along a curve in Lab space for locality:\n"
+                       "                      none (default), morton or hilbert\n"
+                       "  --seeding method    k-means seeding: kmeans++ (default), kmeans||, farthest or wu\n"
+                       "  --repair method     empty cluster repair: split (default) or farthest\n"
+                       "  --max-iter n        cap on k-means iterations, 0 for no cap (default 300)\n"
+                       "  --tol tolerance     stop once centroids move less than this distance in the\n"
+                       "                      clustering space (Lab units)\n"
+                       "  --restarts n        run k-means n times and keep the lowest inertia\n"
+                       "  --init palette      warm start k-means from an earlier #rrggbb palette file\n"
+                       "  --seed seed         RNG seed, negative for random seed\n"
+                       "  --threads threads   worker threads for k-means, 0 for one per core\n"
+                       "\n"
+                       "Exit status is 2 when k-means was cut off by --max-iter or by an assignment cycle.\n";
 
 void output(const std::vector<std::pair<RGB, double>> &scheme, bool colorful, int lines) {
   for (int i = 0; i < scheme.size() && (lines <= 0 || i < lines); i++) {
@@ -45,14 +72,137 @@ void output(const std::vector<std::pair<RGB, double>> &scheme, bool colorful, in
   }
 }
 
+Engine parse_engine(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing engine");
+  } else if (!strcmp(value, "lloyd")) {
+    return Engine::lloyd;
+  } else if (!strcmp(value, "hamerly")) {
+    return Engine::hamerly;
+  } else if (!strcmp(value, "elkan")) {
+    return Engine::elkan;
+  } else if (!strcmp(value, "bounds")) {
+    return Engine::bounds;
+  } else if (!strcmp(value, "kdtree")) {
+    return Engine::kdtree;
+  } else if (!strcmp(value, "minibatch")) {
+    return Engine::minibatch;
+  } else if (!strcmp(value, "bisecting")) {
+    return Engine::bisecting;
+  } else if (!strcmp(value, "fixed")) {
+    return Engine::fixed;
+  }
+  throw std::runtime_error(std::string() + "error: unknown engine \"" + value + "\"");
+}
+
+Seeding parse_seeding(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing seeding");
+  } else if (!strcmp(value, "farthest")) {
+    return Seeding::farthest;
+  } else if (!strcmp(value, "kmeans++")) {
+    return Seeding::kmeanspp;
+  } else if (!strcmp(value, "kmeans||")) {
+    return Seeding::parallel;
+  }
+  throw std::runtime_error(std::string() + "error: unknown seeding \"" + value + "\"");
+}
+
+Criterion parse_criterion(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing criterion");
+  } else if (!strcmp(value, "elbow")) {
+    return Criterion::elbow;
+  } else if (!strcmp(value, "silhouette")) {
+    return Criterion::silhouette;
+  } else if (!strcmp(value, "gap")) {
+    return Criterion::gap;
+  }
+  throw std::runtime_error(std::string() + "error: unknown criterion \"" + value + "\"");
+}
+
+// comma separated list of cluster counts
+std::vector<int> parse_counts(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing clusters");
+  }
+  std::vector<int> counts;
+  for (const char *p = value;; p++) {
+    counts.push_back(atoi(p));
+    p = strchr(p, ',');
+    if (!p) {
+      break;
+    }
+  }
+  return counts;
+}
+
+void print_stats(const KMeansStats &stats) {
+  std::size_t total = stats.distances + stats.skipped;
+  if (stats.batches) {
+    fmt::print(stderr, "batches: {}\n", stats.batches);
+  }
+  fmt::print(stderr, "iterations: {}\ndistance evaluations: {}\nskipped: {} ({:.2f}%)\n", stats.iterations,
+             stats.distances, stats.skipped, total ? 100.0 * stats.skipped / total : 0.0);
+  fmt::print(stderr, "inertia: {:.6g}\n", stats.inertia);
+  if (stats.abandoned) {
+    fmt::print(stderr, "abandoned restarts: {}\n", stats.abandoned);
+  }
+  const char *termination[] = {"converged", "within tolerance", "assignment cycle", "iteration cap"};
+  fmt::print(stderr, "termination: {}\n", termination[(int)stats.termination]);
+}
+
+Space parse_space(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing space");
+  } else if (!strcmp(value, "lab")) {
+    return Space::lab;
+  } else if (!strcmp(value, "oklab")) {
+    return Space::oklab;
+  } else if (!strcmp(value, "rgb")) {
+    return Space::rgb;
+  }
+  throw std::runtime_error(std::string() + "error: unknown space \"" + value + "\"");
+}
+
+Curve parse_order(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing order");
+  } else if (!strcmp(value, "none")) {
+    return Curve::none;
+  } else if (!strcmp(value, "morton")) {
+    return Curve::morton;
+  } else if (!strcmp(value, "hilbert")) {
+    return Curve::hilbert;
+  }
+  throw std::runtime_error(std::string() + "error: unknown order \"" + value + "\"");
+}
+
+Repair parse_repair(const char *value) {
+  if (!value) {
+    throw std::runtime_error("error: missing repair");
+  } else if (!strcmp(value, "split")) {
+    return Repair::split;
+  } else if (!strcmp(value, "farthest")) {
+    return Repair::farthest;
+  }
+  throw std::runtime_error(std::string() + "error: unknown repair \"" + value + "\"");
+}
+
 int main(int argc, const char **argv) {
   const char *filename = nullptr;
+  const char *palette = nullptr;
   int lines = 0;
-  int samples = 1000;
-  int clusters = 8;
+  SchemeOptions options;
+  std::vector<int> counts = {options.clusters};
+  // range searched by --cluster auto, unused while `automatic` is off
+  bool automatic = false;
+  int min_clusters = 2;
+  int max_clusters = 12;
   int seed = -1;
   bool help = false;
   bool colorful = false;
+  bool verbose = false;
 
   for (int i = 1; i < argc; i++) {
     const char *arg = argv[i];
@@ -80,14 +230,86 @@ int main(int argc, const char **argv) {
         help = true;
       } else if (!strcmp(key, "c") || !strcmp(key, "color")) {
         colorful = true;
+      } else if (!strcmp(key, "v") || !strcmp(key, "verbose")) {
+        verbose = true;
       } else if (!strcmp(key, "n")) {
         lines = atoi(value);
         i++;
       } else if (!strcmp(key, "sample")) {
-        samples = atoi(value);
+        options.samples = atoi(value);
         i++;
       } else if (!strcmp(key, "cluster")) {
-        clusters = atoi(value);
+        automatic = value && !strncmp(value, "auto", 4);
+        if (!automatic) {
+          counts = parse_counts(value);
+        } else if (value[4] == ':') {
+          if (sscanf(value + 5, "%d-%d", &min_clusters, &max_clusters) != 2) {
+            throw std::runtime_error(std::string() + "error: malformed cluster range \"" + value + "\"");
+          }
+        } else if (value[4]) {
+          throw std::runtime_error(std::string() + "error: unknown clusters \"" + value + "\"");
+        }
+        i++;
+      } else if (!strcmp(key, "criterion")) {
+        options.criterion = parse_criterion(value);
+        i++;
+      } else if (!strcmp(key, "engine")) {
+        if (value && !strcmp(value, "octree")) {
+          options.quantizer = Quantizer::octree;
+        } else if (value && !strcmp(value, "wu")) {
+          options.quantizer = Quantizer::wu;
+        } else {
+          options.kmeans.engine = parse_engine(value);
+        }
+        i++;
+      } else if (!strcmp(key, "histogram")) {
+        options.histogram_bits = atoi(value);
+        i++;
+      } else if (!strcmp(key, "space")) {
+        options.space = parse_space(value);
+        i++;
+      } else if (!strcmp(key, "lab-table")) {
+        if (!value) {
+          throw std::runtime_error("error: missing lab table");
+        }
+        options.lab_table = value;
+        i++;
+      } else if (!strcmp(key, "lab-cells")) {
+        options.lab_table_cells = atoi(value);
+        i++;
+      } else if (!strcmp(key, "order")) {
+        options.order = parse_order(value);
+        i++;
+      } else if (!strcmp(key, "batch")) {
+        options.kmeans.batch_size = atoi(value);
+        i++;
+      } else if (!strcmp(key, "seeding")) {
+        if (value && !strcmp(value, "wu")) {
+          options.wu_seeding = true;
+        } else {
+          options.kmeans.seeding = parse_seeding(value);
+        }
+        i++;
+      } else if (!strcmp(key, "repair")) {
+        options.kmeans.repair = parse_repair(value);
+        i++;
+      } else if (!strcmp(key, "restarts")) {
+        options.kmeans.restarts = atoi(value);
+        i++;
+      } else if (!strcmp(key, "init")) {
+        if (!value) {
+          throw std::runtime_error("error: missing palette");
+        }
+        palette = value;
+        i++;
+      } else if (!strcmp(key, "max-iter")) {
+        options.kmeans.max_iter = atoi(value);
+        i++;
+      } else if (!strcmp(key, "tol")) {
+        options.kmeans.tol = atof(value);
+        i++;
+      } else if (!strcmp(key, "threads")) {
+        options.kmeans.threads = atoi(value);
         i++;
       } else if (!strcmp(key, "seed")) {
         seed = atoi(value);
@@ -117,8 +339,59 @@ int main(int argc, const char **argv) {
   }
 
   MyRand rng = seed < 0 ? MyRand() : MyRand(seed);
-  auto scheme = color_scheme(filename, clusters, samples, rng);
-  output(scheme, colorful, lines);
 
-  return 0;
+  if (automatic) {
+    if (palette) {
+      throw std::runtime_error("error: --init cannot be used with --cluster auto");
+    }
+    ClusterChoice choice;
+    auto scheme = auto_color_scheme(filename, options, min_clusters, max_clusters, rng, &choice);
+    output(scheme, colorful, lines);
+
+    // the scores behind the choice are always printed, so it can be checked
+    const char *criterion[] = {"elbow", "silhouette", "gap"};
+    fmt::print(stderr, "criterion: {}\n", criterion[(int)options.criterion]);
+    for (std::size_t i = 0; i < choice.counts.size(); i++) {
+      fmt::print(stderr, "clusters: {:3} inertia: {:<12.6g} score: {:.6f}", choice.counts[i], choice.stats[i].inertia,
+                 choice.scores[i]);
+      if (!choice.errors.empty()) {
+        fmt::print(stderr, " +/- {:.6f}", choice.errors[i]);
+      }
+      fmt::print(stderr, "{}\n", i == choice.chosen ? " <" : "");
+    }
+    fmt::print(stderr, "chosen: {}\n", choice.counts[choice.chosen]);
+
+    const KMeansStats &stats = choice.stats[choice.chosen];
+    if (verbose) {
+      print_stats(stats);
+    }
+    return stats.termination == Termination::cycle || stats.termination == Termination::max_iter ? 2 : 0;
+  }
+
+  std::vector<KMeansStats> stats;
+  std::vector<RGB> initial;
+  if (palette) {
+    initial = read_palette(palette);
+  }
+  auto schemes = color_schemes(filename, options, counts, initial, rng, &stats);
+
+  bool cut_off = false;
+  for (std::size_t i = 0; i < schemes.size(); i++) {
+    // several palettes are told apart by a blank line
+    if (i) {
+      fmt::print("\n");
+    }
+    output(schemes[i], colorful, lines);
+
+    // the octree and wu quantizers run no k-means, so there are no statistics to print
+    if (verbose && options.quantizer == Quantizer::kmeans) {
+      if (schemes.size() > 1) {
+        fmt::print(stderr, "clusters: {}\n", counts[i]);
+      }
+      print_stats(stats[i]);
+    }
+    cut_off |= stats[i].termination == Termination::cycle || stats[i].termination == Termination::max_iter;
+  }
+
+  return cut_off ? 2 : 0;
 }
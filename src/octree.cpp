@@ -0,0 +1,189 @@
+#include "octree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// one level per bit of an 8-bit channel, nodes of the last level are always leaves
+const int DEPTH = 8;
+
+Octree::Octree(std::size_t max_leaves) : reducible(DEPTH), max_leaves(max_leaves), leaves(0) { create(0); }
+
+int Octree::create(int level) {
+  int index;
+  if (free_nodes.empty()) {
+    index = nodes.size();
+    nodes.emplace_back();
+  } else {
+    index = free_nodes.back();
+    free_nodes.pop_back();
+  }
+
+  Node &node = nodes[index];
+  node.sum[0] = node.sum[1] = node.sum[2] = 0;
+  node.count = 0;
+  for (int &child : node.children) {
+    child = -1;
+  }
+  node.leaf = level == DEPTH;
+  if (node.leaf) {
+    leaves++;
+  } else {
+    reducible[level].push_back(index);
+  }
+  return index;
+}
+
+// merge the children of an interior node into the node itself, they are all leaves by then
+void Octree::fold(int index) {
+  int merged = 0;
+  for (int &child : nodes[index].children) {
+    if (child >= 0) {
+      for (int c = 0; c < 3; c++) {
+        nodes[index].sum[c] += nodes[child].sum[c];
+      }
+      free_nodes.push_back(child);
+      child = -1;
+      merged++;
+    }
+  }
+  nodes[index].leaf = true;
+  leaves -= merged - 1;
+}
+
+// merge the lightest child leaf of an interior node into the sibling whose mean color is closest
+void Octree::merge_lightest(int index) {
+  int *children = nodes[index].children;
+  int light = -1;
+  for (int o = 0; o < 8; o++) {
+    if (children[o] >= 0 && (light < 0 || nodes[children[o]].count < nodes[children[light]].count)) {
+      light = o;
+    }
+  }
+
+  const Node &from = nodes[children[light]];
+  int closest = -1;
+  double closest_dist2 = 0;
+  for (int o = 0; o < 8; o++) {
+    if (o == light || children[o] < 0) {
+      continue;
+    }
+    const Node &to = nodes[children[o]];
+    double dist2 = 0;
+    for (int c = 0; c < 3; c++) {
+      double diff = (double)from.sum[c] / from.count - (double)to.sum[c] / to.count;
+      dist2 += diff * diff;
+    }
+    if (closest < 0 || dist2 < closest_dist2) {
+      closest = o;
+      closest_dist2 = dist2;
+    }
+  }
+
+  Node &to = nodes[children[closest]];
+  for (int c = 0; c < 3; c++) {
+    to.sum[c] += from.sum[c];
+  }
+  to.count += from.count;
+  free_nodes.push_back(children[light]);
+  children[light] = -1;
+  leaves--;
+}
+
+void Octree::fold_deepest(bool lightest) {
+  int level = DEPTH - 1;
+  while (reducible[level].empty()) {
+    level--;
+  }
+
+  std::vector<int> &candidates = reducible[level];
+  int index = lightest ? this->lightest(candidates) : candidates.back();
+  std::swap(*std::find(candidates.rbegin(), candidates.rend(), index), candidates.back());
+  candidates.pop_back();
+  fold(index);
+}
+
+int Octree::lightest(const std::vector<int> &candidates) const {
+  int pick = candidates.back();
+  for (int index : candidates) {
+    if (nodes[index].count < nodes[pick].count) {
+      pick = index;
+    }
+  }
+  return pick;
+}
+
+void Octree::add(const unsigned char *pixels, std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) {
+    const unsigned char *pixel = pixels + i * 3;
+    int index = 0;
+    for (int level = 0;; level++) {
+      nodes[index].count++;
+      if (nodes[index].leaf) {
+        break;
+      }
+      int shift = DEPTH - 1 - level;
+      int octant = ((pixel[0] >> shift) & 1) << 2 | ((pixel[1] >> shift) & 1) << 1 | ((pixel[2] >> shift) & 1);
+      int child = nodes[index].children[octant];
+      if (child < 0) {
+        // create() may grow the node pool, so the parent is looked up again afterwards
+        child = create(level + 1);
+        nodes[index].children[octant] = child;
+      }
+      index = child;
+    }
+    for (int c = 0; c < 3; c++) {
+      nodes[index].sum[c] += pixel[c];
+    }
+
+    while (leaves > max_leaves) {
+      fold_deepest(false);
+    }
+  }
+}
+
+std::vector<std::pair<RGB, std::size_t>> Octree::reduce(int k) {
+  while (leaves > (std::size_t)k) {
+    int level = DEPTH - 1;
+    while (reducible[level].empty()) {
+      level--;
+    }
+    int index = lightest(reducible[level]);
+    int children = 0;
+    for (int child : nodes[index].children) {
+      children += child >= 0;
+    }
+
+    if (leaves - (children - 1) >= (std::size_t)k) {
+      fold_deepest(true);
+    } else {
+      // folding the whole node would undershoot k, so only enough of its children are merged
+      while (leaves > (std::size_t)k) {
+        merge_lightest(index);
+      }
+    }
+  }
+
+  std::vector<std::pair<RGB, std::size_t>> palette;
+  std::vector<int> stack = {0};
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.leaf) {
+      if (node.count) {
+        RGB rgb = {(double)node.sum[0] / node.count, (double)node.sum[1] / node.count,
+                   (double)node.sum[2] / node.count};
+        palette.push_back({rgb, node.count});
+      }
+      continue;
+    }
+    for (int child : node.children) {
+      if (child >= 0) {
+        stack.push_back(child);
+      }
+    }
+  }
+  return palette;
+}
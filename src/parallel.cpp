@@ -0,0 +1,58 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void parallel_for(int threads, std::size_t tasks, const std::function<void(std::size_t)> &fn) {
+  std::size_t workers = std::min<std::size_t>(std::max(threads, 1), tasks);
+  if (workers <= 1) {
+    for (std::size_t task = 0; task < tasks; task++) {
+      fn(task);
+    }
+    return;
+  }
+
+  std::atomic<std::size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&]() {
+    for (std::size_t task = next++; task < tasks; task = next++) {
+      try {
+        fn(task);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next = tasks;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (std::size_t i = 1; i < workers; i++) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : pool) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+int thread_count(int threads) {
+  if (threads > 0) {
+    return threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
@@ -0,0 +1,224 @@
+#include "wu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+WuQuantizer::WuQuantizer() : cumulative(false) {
+  std::size_t cells = (std::size_t)SIDE * SIDE * SIDE;
+  weight.assign(cells, 0);
+  for (auto &m : moment) {
+    m.assign(cells, 0);
+  }
+  moment2.assign(cells, 0);
+}
+
+void WuQuantizer::add(const unsigned char *pixels, std::size_t n) {
+  int shift = 8 - BITS;
+  for (std::size_t i = 0; i < n; i++) {
+    const unsigned char *pixel = pixels + i * 3;
+    std::size_t cell = index((pixel[0] >> shift) + 1, (pixel[1] >> shift) + 1, (pixel[2] >> shift) + 1);
+    weight[cell]++;
+    for (int c = 0; c < 3; c++) {
+      moment[c][cell] += pixel[c];
+    }
+    moment2[cell] += (double)pixel[0] * pixel[0] + (double)pixel[1] * pixel[1] + (double)pixel[2] * pixel[2];
+  }
+}
+
+// turn the histogram into moments of the box from the origin to each cell
+void WuQuantizer::accumulate() {
+  for (int r = 1; r < SIDE; r++) {
+    int64_t area_w[SIDE] = {0};
+    int64_t area_m[3][SIDE] = {{0}};
+    double area_m2[SIDE] = {0};
+    for (int g = 1; g < SIDE; g++) {
+      int64_t line_w = 0;
+      int64_t line_m[3] = {0};
+      double line_m2 = 0;
+      for (int b = 1; b < SIDE; b++) {
+        std::size_t cell = index(r, g, b);
+        std::size_t below = index(r - 1, g, b);
+        line_w += weight[cell];
+        area_w[b] += line_w;
+        weight[cell] = weight[below] + area_w[b];
+        for (int c = 0; c < 3; c++) {
+          line_m[c] += moment[c][cell];
+          area_m[c][b] += line_m[c];
+          moment[c][cell] = moment[c][below] + area_m[c][b];
+        }
+        line_m2 += moment2[cell];
+        area_m2[b] += line_m2;
+        moment2[cell] = moment2[below] + area_m2[b];
+      }
+    }
+  }
+  cumulative = true;
+}
+
+template <typename T> T WuQuantizer::volume(const Box &box, const std::vector<T> &m) const {
+  const int *lo = box.lo;
+  const int *hi = box.hi;
+  return m[index(hi[0], hi[1], hi[2])] - m[index(hi[0], hi[1], lo[2])] - m[index(hi[0], lo[1], hi[2])] +
+         m[index(hi[0], lo[1], lo[2])] - m[index(lo[0], hi[1], hi[2])] + m[index(lo[0], hi[1], lo[2])] +
+         m[index(lo[0], lo[1], hi[2])] - m[index(lo[0], lo[1], lo[2])];
+}
+
+// the part of volume() that does not depend on the upper bound along `dir`
+template <typename T> T WuQuantizer::bottom(const Box &box, int dir, const std::vector<T> &m) const {
+  int a = (dir + 1) % 3;
+  int b = (dir + 2) % 3;
+  int at[3];
+  auto corner = [&](int ia, int ib) {
+    at[dir] = box.lo[dir];
+    at[a] = ia;
+    at[b] = ib;
+    return m[index(at[0], at[1], at[2])];
+  };
+  return -corner(box.hi[a], box.hi[b]) + corner(box.hi[a], box.lo[b]) + corner(box.lo[a], box.hi[b]) -
+         corner(box.lo[a], box.lo[b]);
+}
+
+// the part of volume() that depends on the upper bound along `dir`, with that bound set to `pos`
+template <typename T> T WuQuantizer::top(const Box &box, int dir, int pos, const std::vector<T> &m) const {
+  int a = (dir + 1) % 3;
+  int b = (dir + 2) % 3;
+  int at[3];
+  auto corner = [&](int ia, int ib) {
+    at[dir] = pos;
+    at[a] = ia;
+    at[b] = ib;
+    return m[index(at[0], at[1], at[2])];
+  };
+  return corner(box.hi[a], box.hi[b]) - corner(box.hi[a], box.lo[b]) - corner(box.lo[a], box.hi[b]) +
+         corner(box.lo[a], box.lo[b]);
+}
+
+// weighted squared error of the box around its mean
+double WuQuantizer::variance(const Box &box) const {
+  double w = volume(box, weight);
+  if (w <= 0) {
+    return 0;
+  }
+  double sq = 0;
+  for (int c = 0; c < 3; c++) {
+    double s = volume(box, moment[c]);
+    sq += s * s;
+  }
+  return volume(box, moment2) - sq / w;
+}
+
+// Find the cut along `dir` in (first, last) that maximizes the sum over both halves of |sum|^2 / weight, which is
+// the same as minimizing their squared error. Returns that sum, or 0 when no cut leaves both halves occupied.
+double WuQuantizer::maximize(const Box &box, int dir, int first, int last, int &cut, const int64_t *whole,
+                             int64_t whole_w) const {
+  int64_t base[3];
+  for (int c = 0; c < 3; c++) {
+    base[c] = bottom(box, dir, moment[c]);
+  }
+  int64_t base_w = bottom(box, dir, weight);
+
+  double best = 0;
+  cut = -1;
+  for (int pos = first; pos < last; pos++) {
+    int64_t half[3];
+    int64_t half_w = base_w + top(box, dir, pos, weight);
+    if (half_w == 0 || half_w == whole_w) {
+      continue;
+    }
+    double score = 0;
+    for (int c = 0; c < 3; c++) {
+      half[c] = base[c] + top(box, dir, pos, moment[c]);
+      score += (double)half[c] * half[c];
+    }
+    score /= half_w;
+    double rest = 0;
+    for (int c = 0; c < 3; c++) {
+      double other = (double)(whole[c] - half[c]);
+      rest += other * other;
+    }
+    score += rest / (whole_w - half_w);
+    if (score > best) {
+      best = score;
+      cut = pos;
+    }
+  }
+  return best;
+}
+
+// split `box` in two along the best plane of any axis, `box` keeps the lower half and `other` gets the upper one
+bool WuQuantizer::cut(Box &box, Box &other) const {
+  int64_t whole[3];
+  for (int c = 0; c < 3; c++) {
+    whole[c] = volume(box, moment[c]);
+  }
+  int64_t whole_w = volume(box, weight);
+
+  int best_dir = -1;
+  int best_cut = -1;
+  double best = 0;
+  for (int dir = 0; dir < 3; dir++) {
+    int pos;
+    double score = maximize(box, dir, box.lo[dir] + 1, box.hi[dir], pos, whole, whole_w);
+    if (pos >= 0 && score > best) {
+      best = score;
+      best_dir = dir;
+      best_cut = pos;
+    }
+  }
+  if (best_dir < 0) {
+    return false;
+  }
+
+  other = box;
+  box.hi[best_dir] = best_cut;
+  other.lo[best_dir] = best_cut;
+  return true;
+}
+
+std::vector<std::pair<RGB, std::size_t>> WuQuantizer::reduce(int k) {
+  if (!cumulative) {
+    accumulate();
+  }
+
+  std::vector<Box> boxes(1);
+  for (int c = 0; c < 3; c++) {
+    boxes[0].lo[c] = 0;
+    boxes[0].hi[c] = SIDE - 1;
+  }
+  std::vector<double> error = {variance(boxes[0])};
+
+  while ((int)boxes.size() < k) {
+    // split the box with the largest error, boxes that cannot be split are marked with zero error
+    std::size_t next = 0;
+    for (std::size_t i = 1; i < boxes.size(); i++) {
+      if (error[i] > error[next]) {
+        next = i;
+      }
+    }
+    if (error[next] <= 0) {
+      break;
+    }
+
+    Box other;
+    if (cut(boxes[next], other)) {
+      boxes.push_back(other);
+      error[next] = variance(boxes[next]);
+      error.push_back(variance(other));
+    } else {
+      error[next] = 0;
+    }
+  }
+
+  std::vector<std::pair<RGB, std::size_t>> palette;
+  for (const Box &box : boxes) {
+    int64_t w = volume(box, weight);
+    if (w > 0) {
+      RGB rgb = {(double)volume(box, moment[0]) / w, (double)volume(box, moment[1]) / w,
+                 (double)volume(box, moment[2]) / w};
+      palette.push_back({rgb, (std::size_t)w});
+    }
+  }
+  return palette;
+}
@@ -0,0 +1,162 @@
+#include "color_space.h"
+#include "kmeans.h"
+#include "kmeans_fixed.h"
+#include "myrand.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/**
+ * Checks the fixed engine against Lloyd on the same Lab samples and initial centroids, by the bounds documented for
+ * FixedPoints. After one pass from the same centroids, every fixed centroid must lie within sqrt(Dim) * step / 2 of
+ * the mean of its original member points, no point may go to a centroid 2 * sqrt(Dim) * step or more further than
+ * the nearest one Lloyd picks, and the squared distances to the assigned centroids may sum to no more than this slack
+ * allows. Run to convergence, the centroid bound must still hold and the inertia stay close to Lloyd's. Exits with
+ * status 1 when a bound is exceeded.
+ */
+
+const int DIM = 3;
+// largest relative inertia difference between the converged runs, which may settle in nearby optima
+const double MAX_INERTIA_DIFF = 1e-3;
+// rounding allowance of the double arithmetic the checks themselves do
+const double EPSILON = 1e-9;
+
+const int BLOBS = 12;
+const std::size_t BLOB_PIXELS = 20000;
+
+// Pixels scattered around random colors, from a fixed seed and without library distributions, so every platform
+// draws the same image.
+std::vector<unsigned char> test_pixels() {
+  std::mt19937 gen(7);
+  std::vector<unsigned char> pixels;
+  for (int blob = 0; blob < BLOBS; blob++) {
+    int center[3] = {(int)(gen() % 256), (int)(gen() % 256), (int)(gen() % 256)};
+    for (std::size_t j = 0; j < BLOB_PIXELS; j++) {
+      for (int c = 0; c < 3; c++) {
+        int value = center[c] + (int)(gen() % 41) - 20;
+        pixels.push_back((unsigned char)std::min(std::max(value, 0), 255));
+      }
+    }
+  }
+  return pixels;
+}
+
+using Sample = std::array<double, DIM>;
+
+double distance(const BasicKMeans<DIM> &km, std::size_t j, const Sample &centroid) {
+  double dist2 = 0;
+  for (int d = 0; d < DIM; d++) {
+    double diff = km.channel(d)[j] - centroid[d];
+    dist2 += diff * diff;
+  }
+  return std::sqrt(dist2);
+}
+
+// Largest distance from a centroid to the mean of the original points labelled with it.
+double max_centroid_error(const BasicKMeans<DIM> &km, const std::vector<BasicKMeans<DIM>::Cluster> &clusters) {
+  const std::vector<uint32_t> &labels = km.get_labels();
+  std::vector<Sample> sums(clusters.size(), Sample{});
+  std::vector<std::size_t> counts(clusters.size());
+  for (std::size_t j = 0; j < km.size(); j++) {
+    for (int d = 0; d < DIM; d++) {
+      sums[labels[j]][d] += km.channel(d)[j];
+    }
+    counts[labels[j]]++;
+  }
+
+  double max_error = 0;
+  for (std::size_t i = 0; i < clusters.size(); i++) {
+    double error2 = 0;
+    for (int d = 0; counts[i] && d < DIM; d++) {
+      double diff = clusters[i].centroid[d] - sums[i][d] / counts[i];
+      error2 += diff * diff;
+    }
+    max_error = std::max(max_error, std::sqrt(error2));
+  }
+  return max_error;
+}
+
+bool report(const char *check, int k, double value, double bound) {
+  bool ok = value <= bound;
+  std::printf("%-26s k=%-3d %.3g (bound %.3g) %s\n", check, k, value, bound, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main() {
+  std::vector<unsigned char> pixels = test_pixels();
+  std::size_t n = pixels.size() / 3;
+  std::vector<double> l(n), a(n), b(n);
+  rgb_to_lab(pixels.data(), n, l.data(), a.data(), b.data());
+  BasicKMeans<DIM> km;
+  km.reserve(n);
+  for (std::size_t j = 0; j < n; j++) {
+    km.push_back({l[j], a[j], b[j]});
+  }
+
+  const double *channels[DIM] = {km.channel(0), km.channel(1), km.channel(2)};
+  double step = FixedPoints<DIM, double>(channels, n).step();
+  double centroid_bound = std::sqrt((double)DIM) * step / 2;
+  double assignment_bound = 2 * std::sqrt((double)DIM) * step;
+  std::printf("step %.3g\n", step);
+
+  int status = 0;
+  for (int k : {8, 16}) {
+    // initial centroids at evenly spread pixels, the same for both engines
+    std::vector<Sample> initial;
+    for (int i = 0; i < k; i++) {
+      std::size_t j = n / k * i + n / (2 * k);
+      initial.push_back({l[j], a[j], b[j]});
+    }
+
+    // one pass from the same centroids
+    KMeansOptions options;
+    options.max_iter = 1;
+    MyRand rng(1);
+    km.set_options(options);
+    km.cluster(k, initial, rng);
+    std::vector<uint32_t> lloyd_labels = km.get_labels();
+
+    options.engine = Engine::fixed;
+    km.set_options(options);
+    auto fixed_clusters = km.cluster(k, initial, rng);
+    const std::vector<uint32_t> &fixed_labels = km.get_labels();
+
+    double max_slack = 0;
+    double lloyd_cost = 0;
+    double fixed_cost = 0;
+    double cost_bound = 0;
+    for (std::size_t j = 0; j < n; j++) {
+      double nearest = distance(km, j, initial[lloyd_labels[j]]);
+      double assigned = distance(km, j, initial[fixed_labels[j]]);
+      max_slack = std::max(max_slack, assigned - nearest);
+      lloyd_cost += nearest * nearest;
+      fixed_cost += assigned * assigned;
+      cost_bound += (nearest + assignment_bound) * (nearest + assignment_bound);
+    }
+
+    status |= !report("pass centroid error", k, max_centroid_error(km, fixed_clusters), centroid_bound + EPSILON);
+    status |= !report("pass assignment slack", k, max_slack, assignment_bound);
+    status |= !report("pass cost over lloyd", k, fixed_cost - lloyd_cost, cost_bound - lloyd_cost);
+
+    // whole runs
+    options = KMeansOptions();
+    km.set_options(options);
+    km.cluster(k, initial, rng);
+    double lloyd_inertia = km.get_stats().inertia;
+
+    options.engine = Engine::fixed;
+    km.set_options(options);
+    fixed_clusters = km.cluster(k, initial, rng);
+    double fixed_inertia = km.get_stats().inertia;
+
+    status |= !report("run centroid error", k, max_centroid_error(km, fixed_clusters), centroid_bound + EPSILON);
+    status |= !report("run inertia difference", k, std::fabs(fixed_inertia - lloyd_inertia) / lloyd_inertia,
+                      MAX_INERTIA_DIFF);
+  }
+  return status;
+}
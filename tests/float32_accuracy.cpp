@@ -0,0 +1,102 @@
+#include "color_space.h"
+#include "kmeans.h"
+#include "myrand.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/**
+ * Checks that clustering in single precision, as the float32 option builds it, gives the palette of the double
+ * pipeline. The same pixels are converted and clustered in both precisions from the same initial centroids, and every
+ * centroid pair is compared by CIEDE2000 and share. Exits with status 1 when a bound is exceeded.
+ */
+
+// largest CIEDE2000 between the float and the double centroid allowed; the two agree within about 1e-5
+const double MAX_DIFF = 0.01;
+// largest difference in the share of pixels a cluster holds
+const double MAX_SHARE_DIFF = 0.001;
+
+const int BLOBS = 12;
+const std::size_t BLOB_PIXELS = 20000;
+
+// Pixels scattered around random colors, from a fixed seed and without library distributions, so every platform
+// draws the same image.
+std::vector<unsigned char> test_pixels() {
+  std::mt19937 gen(42);
+  std::vector<unsigned char> pixels;
+  for (int blob = 0; blob < BLOBS; blob++) {
+    int center[3] = {(int)(gen() % 256), (int)(gen() % 256), (int)(gen() % 256)};
+    for (std::size_t j = 0; j < BLOB_PIXELS; j++) {
+      for (int c = 0; c < 3; c++) {
+        int value = center[c] + (int)(gen() % 41) - 20;
+        pixels.push_back((unsigned char)std::min(std::max(value, 0), 255));
+      }
+    }
+  }
+  return pixels;
+}
+
+template <typename Scalar> BasicKMeans<3, Scalar> load(const std::vector<unsigned char> &pixels) {
+  std::size_t n = pixels.size() / 3;
+  std::vector<Scalar> l(n), a(n), b(n);
+  rgb_to_lab(pixels.data(), n, l.data(), a.data(), b.data());
+  BasicKMeans<3, Scalar> km;
+  km.reserve(n);
+  for (std::size_t j = 0; j < n; j++) {
+    km.push_back({l[j], a[j], b[j]});
+  }
+  return km;
+}
+
+int main() {
+  std::vector<unsigned char> pixels = test_pixels();
+  std::size_t n = pixels.size() / 3;
+  BasicKMeans<3, double> km_double = load<double>(pixels);
+  BasicKMeans<3, float> km_float = load<float>(pixels);
+
+  const Engine engines[] = {Engine::lloyd, Engine::hamerly, Engine::elkan, Engine::kdtree, Engine::fixed};
+  const char *names[] = {"lloyd", "hamerly", "elkan", "kdtree", "fixed"};
+  int status = 0;
+  for (int e = 0; e < 5; e++) {
+    for (int k : {8, 16}) {
+      // initial centroids at evenly spread pixels, the same for both precisions
+      std::vector<std::array<double, 3>> initial_double;
+      std::vector<std::array<float, 3>> initial_float;
+      for (int i = 0; i < k; i++) {
+        std::size_t j = n / k * i + n / (2 * k);
+        initial_double.push_back({km_double.channel(0)[j], km_double.channel(1)[j], km_double.channel(2)[j]});
+        initial_float.push_back({km_float.channel(0)[j], km_float.channel(1)[j], km_float.channel(2)[j]});
+      }
+
+      KMeansOptions options;
+      options.engine = engines[e];
+      km_double.set_options(options);
+      km_float.set_options(options);
+      MyRand rng(1);
+      auto clusters_double = km_double.cluster(k, initial_double, rng);
+      auto clusters_float = km_float.cluster(k, initial_float, rng);
+
+      double max_diff = 0;
+      double max_share_diff = 0;
+      bool same_size = clusters_double.size() == clusters_float.size();
+      for (std::size_t i = 0; same_size && i < clusters_double.size(); i++) {
+        const auto &cd = clusters_double[i];
+        const auto &cf = clusters_float[i];
+        LAB lab_double = {cd.centroid[0], cd.centroid[1], cd.centroid[2]};
+        LAB lab_float = {cf.centroid[0], cf.centroid[1], cf.centroid[2]};
+        max_diff = std::max(max_diff, color_diff(lab_double, lab_float));
+        max_share_diff = std::max(max_share_diff, std::fabs((double)cd.count - (double)cf.count) / n);
+      }
+
+      bool ok = same_size && max_diff <= MAX_DIFF && max_share_diff <= MAX_SHARE_DIFF;
+      std::printf("%-8s k=%-3d max CIEDE2000 %.3g (bound %g), max share difference %.3g (bound %g) %s\n", names[e], k,
+                  max_diff, MAX_DIFF, max_share_diff, MAX_SHARE_DIFF, ok ? "ok" : "FAILED");
+      status |= !ok;
+    }
+  }
+  return status;
+}
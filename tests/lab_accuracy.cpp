@@ -0,0 +1,85 @@
+#include "color_space.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+/**
+ * Checks the fast RGB to Lab conversion (decoding table, bit-level cube root and the batch kernels) against a plain
+ * pow() reference, by CIEDE2000 over every third value of each channel, 255 included. Exits with status 1 when a
+ * bound is exceeded.
+ */
+
+// largest CIEDE2000 from the reference allowed in double, which the fast path keeps near 1e-12
+const double MAX_DIFF_DOUBLE = 1e-9;
+// in float, rounding of the single-precision arithmetic alone reaches about 1e-4
+const double MAX_DIFF_FLOAT = 1e-3;
+
+const int STEP = 3;
+
+LAB reference_lab(int r, int g, int b) {
+  auto linear = [](int v) {
+    double c = v / 255.0;
+    return c > 0.04045 ? std::pow((c + 0.055) / 1.055, 2.4) : c / 12.92;
+  };
+  auto f = [](double t) { return t > 0.008856 ? std::pow(t, 1.0 / 3) : 7.787 * t + 16.0 / 116; };
+
+  double lr = linear(r);
+  double lg = linear(g);
+  double lb = linear(b);
+  double x = (lr * 0.4124 + lg * 0.3576 + lb * 0.1805) * 100 / 95.047;
+  double y = lr * 0.2126 + lg * 0.7152 + lb * 0.0722;
+  double z = (lr * 0.0193 + lg * 0.1192 + lb * 0.9505) * 100 / 108.883;
+  return {116 * f(y) - 16, 500 * (f(x) - f(y)), 200 * (f(y) - f(z))};
+}
+
+struct Worst {
+  const char *name;
+  double bound;
+  double diff = 0;
+};
+
+int main() {
+  std::vector<unsigned char> pixels;
+  for (int r = 0; r < 256; r += STEP) {
+    for (int g = 0; g < 256; g += STEP) {
+      for (int b = 0; b < 256; b += STEP) {
+        pixels.insert(pixels.end(), {(unsigned char)r, (unsigned char)g, (unsigned char)b});
+      }
+    }
+  }
+  std::size_t n = pixels.size() / 3;
+
+  std::vector<double> dl(n), da(n), db(n);
+  std::vector<float> fl(n), fa(n), fb(n);
+  rgb_to_lab(pixels.data(), n, dl.data(), da.data(), db.data());
+  rgb_to_lab(pixels.data(), n, fl.data(), fa.data(), fb.data());
+
+  Worst worst[] = {{"rgb_to_lab<double>", MAX_DIFF_DOUBLE},
+                   {"rgb_to_lab<float>", MAX_DIFF_FLOAT},
+                   {"batch rgb_to_lab<double>", MAX_DIFF_DOUBLE},
+                   {"batch rgb_to_lab<float>", MAX_DIFF_FLOAT}};
+  for (std::size_t j = 0; j < n; j++) {
+    int r = pixels[j * 3];
+    int g = pixels[j * 3 + 1];
+    int b = pixels[j * 3 + 2];
+    LAB reference = reference_lab(r, g, b);
+
+    LAB lab = rgb_to_lab(RGB{(double)r, (double)g, (double)b});
+    BasicLAB<float> flab = rgb_to_lab(BasicRGB<float>{(float)r, (float)g, (float)b});
+    LAB found[] = {lab, {flab.l, flab.a, flab.b}, {dl[j], da[j], db[j]}, {fl[j], fa[j], fb[j]}};
+    for (int i = 0; i < 4; i++) {
+      worst[i].diff = std::max(worst[i].diff, color_diff(reference, found[i]));
+    }
+  }
+
+  int status = 0;
+  for (const Worst &w : worst) {
+    bool ok = w.diff <= w.bound;
+    std::printf("%-26s max CIEDE2000 %.3g (bound %.0e) %s\n", w.name, w.diff, w.bound, ok ? "ok" : "FAILED");
+    status |= !ok;
+  }
+  return status;
+}
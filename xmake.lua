@@ -1,11 +1,102 @@
 add_rules("mode.debug", "mode.release")
 add_requires("fmt")
 
+option("native")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Optimize for the build machine's CPU, enabling the AVX k-means kernels")
+    add_cxflags("-march=native")
+option_end()
+
+option("float32")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Sample, convert and cluster colors in single precision")
+    add_defines("COLOR_SCHEME_FLOAT32")
+option_end()
+
+option("exact_lab")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Convert to Lab with pow() instead of the gamma table and the fast cube root")
+    add_defines("COLOR_SCHEME_EXACT_LAB")
+option_end()
+
 target("color-scheme")
     set_kind("binary")
     add_files("src/*.cpp")
     add_includedirs("include")
     add_packages("fmt")
+    add_syslinks("pthread")
+    add_options("native", "float32", "exact_lab")
+
+-- accuracy checks, built and run by `xmake test`; each exits non-zero when a bound is exceeded
+target("lab_accuracy")
+    set_kind("binary")
+    set_default(false)
+    add_files("tests/lab_accuracy.cpp", "src/color_space*.cpp")
+    add_includedirs("include")
+    add_options("native", "float32", "exact_lab")
+    add_tests("default")
+
+target("float32_accuracy")
+    set_kind("binary")
+    set_default(false)
+    add_files("tests/float32_accuracy.cpp", "src/color_space*.cpp", "src/kmeans*.cpp", "src/kdtree.cpp")
+    add_files("src/curve.cpp", "src/myrand.cpp", "src/parallel.cpp")
+    add_includedirs("include")
+    add_syslinks("pthread")
+    add_options("native", "float32", "exact_lab")
+    add_tests("default")
+
+target("fixed_accuracy")
+    set_kind("binary")
+    set_default(false)
+    add_files("tests/fixed_accuracy.cpp", "src/color_space*.cpp", "src/kmeans*.cpp", "src/kdtree.cpp")
+    add_files("src/curve.cpp", "src/myrand.cpp", "src/parallel.cpp")
+    add_includedirs("include")
+    add_syslinks("pthread")
+    add_options("native", "float32", "exact_lab")
+    add_tests("default")
+
+-- benchmarks, built with `xmake build -g bench`; each prints a table of timings
+target("bench_minibatch")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    add_files("bench/minibatch.cpp", "src/color_space*.cpp", "src/kmeans*.cpp", "src/kdtree.cpp")
+    add_files("src/curve.cpp", "src/myrand.cpp", "src/parallel.cpp")
+    add_includedirs("include")
+    add_syslinks("pthread")
+    add_options("native", "float32", "exact_lab")
+
+target("bench_seeding")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    add_files("bench/seeding.cpp", "src/color_space*.cpp", "src/kmeans*.cpp", "src/kdtree.cpp")
+    add_files("src/curve.cpp", "src/myrand.cpp", "src/parallel.cpp")
+    add_includedirs("include")
+    add_syslinks("pthread")
+    add_options("native", "float32", "exact_lab")
+
+target("bench_layout")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    add_files("bench/layout.cpp", "src/color_space*.cpp", "src/kmeans_kernel.cpp")
+    add_includedirs("include")
+    add_options("native", "float32", "exact_lab")
+
+target("bench_threads")
+    set_kind("binary")
+    set_default(false)
+    set_group("bench")
+    add_files("bench/threads.cpp", "src/color_space*.cpp", "src/kmeans*.cpp", "src/kdtree.cpp")
+    add_files("src/curve.cpp", "src/myrand.cpp", "src/parallel.cpp")
+    add_includedirs("include")
+    add_syslinks("pthread")
+    add_options("native", "float32", "exact_lab")
 
 --
 -- If you want to known more usage about xmake, please see https://xmake.io